@@ -6,3 +6,5 @@
 #include "move_gen.c"
 #include "search.c"
 #include "eval.c"
+#include "tune.c"
+#include "selfplay.c"
@@ -8,20 +8,19 @@
 #include "./move_gen.h"
 #include "./tbassert.h"
 
-// The reason for this constant is to handle floating point errors.
-// For example, casting 12.000000 to an int is sometimes 11 and sometimes 12.
-// Used in the h_squares_attackable heuristic.
-#define EPSILON 1e-7
-#define NUM_SENTINELS (ARR_SIZE - (BOARD_WIDTH * BOARD_WIDTH))
-#define between(c, a, b) ((((c) >= (a)) && ((c) <= (b))) || (((c) <= (a)) && ((c) >= (b))))
-#define MIN_SQUARE_VALUE 68
+// h_dist values are kept in units of 1/H_DIST_SCALE, a multiple of 1, 2, ...,
+// BOARD_WIDTH, so that the table and the sums of the h_squares_attackable
+// heuristic are exact integers, and truncating them is exact as well.
+#if BOARD_WIDTH == 8
+#define H_DIST_SCALE 840        // lcm(1, ..., 8)
+#else
+#define H_DIST_SCALE 2520       // lcm(1, ..., 10)
+#endif
 
 // -----------------------------------------------------------------------------
 // Evaluation
 // -----------------------------------------------------------------------------
 
-typedef int32_t ev_score_t;     // Static evaluator uses "hi res" values
-
 int RANDOMIZE;
 
 int PCENTRAL;
@@ -36,59 +35,60 @@ int PAWNPIN;
 // Heuristics for static evaluation - described in the google doc
 // mentioned in the handout.
 
-// Table for the pcentral heuristic below.
-ev_score_t pcentral_table[BOARD_WIDTH][BOARD_WIDTH] = {
-  {125, 181, 220, 234, 234, 220, 181, 125},
-  {181, 249, 302, 323, 323, 302, 249, 181},
-  {220, 302, 375, 411, 411, 375, 302, 220},
-  {234, 323, 411, 500, 500, 411, 323, 234},
-  {234, 323, 411, 500, 500, 411, 323, 234},
-  {220, 302, 375, 411, 411, 375, 302, 220},
-  {181, 249, 302, 323, 323, 302, 249, 181},
-  {125, 181, 220, 234, 234, 220, 181, 125}
-};
+// Table for the pcentral heuristic below, filled in by init_eval_tables().
+ev_score_t pcentral_table[BOARD_WIDTH][BOARD_WIDTH];
+ev_score_t pawn_ev_table[ARR_SIZE];
 
-// PCENTRAL heuristic: Bonus for Pawn near center of board
-ev_score_t pcentral(fil_t f, rnk_t r) {
-  float df = BOARD_WIDTH / 2 - f - 1;
+// PCENTRAL heuristic: Bonus for Pawn near center of board, per unit of weight
+static double pcentral_bonus(fil_t f, rnk_t r) {
+  double df = BOARD_WIDTH / 2 - f - 1;
   if (df < 0) {
     df = f - BOARD_WIDTH / 2;
   }
-  float dr = BOARD_WIDTH / 2 - r - 1;
+  double dr = BOARD_WIDTH / 2 - r - 1;
   if (dr < 0) {
     dr = r - BOARD_WIDTH / 2;
   }
-  float bonus = 1 - sqrt(df * df + dr * dr) / BOARD_WIDTH * sqrt(2);
-  return PCENTRAL * bonus;
-}
-
-// returns true if c lies on or between a and b, which are not ordered
-// bool between(int c, int a, int b) {
-//   bool x = ((c >= a) && (c <= b)) || ((c <= a) && (c >= b));
-//   return x;
-// }
-
-// PBETWEEN heuristic: Bonus for Pawn at (f, r) in rectangle defined by Kings at the corners
-ev_score_t pbetween(position_t * p, fil_t f, rnk_t r) {
-  bool is_between =
-    between(f, fil_of(p->kloc[WHITE]), fil_of(p->kloc[BLACK])) &&
-    between(r, rnk_of(p->kloc[WHITE]), rnk_of(p->kloc[BLACK]));
-  //return is_between ? PBETWEEN : 0;
-  return (-((int) is_between)) & PBETWEEN;
-}
-
-
-// KFACE heuristic: bonus (or penalty) for King facing toward the other King
-ev_score_t kface(position_t * p, fil_t f, rnk_t r) {
-  square_t sq = square_table[f][r];
-  piece_t x = p->board[sq];
-  color_t c = color_of(x);
-  square_t opp_sq = p->kloc[opp_color(c)];
-  int delta_fil = fil_of(opp_sq) - f;
-  int delta_rnk = rnk_of(opp_sq) - r;
+  return 1 - sqrt(df * df + dr * dr) / BOARD_WIDTH * sqrt(2);
+}
+
+ev_score_t pcentral(fil_t f, rnk_t r) {
+  return PCENTRAL * pcentral_bonus(f, r);
+}
+
+// files_between_bb[f0][f1]: the squares on files f0 through f1, and
+// ranks_between_bb[r0][r1]: the squares on ranks r0 through r1, in either
+// order.  Filled in by init_eval_tables().
+bitboard_t files_between_bb[BOARD_WIDTH][BOARD_WIDTH];
+bitboard_t ranks_between_bb[BOARD_WIDTH][BOARD_WIDTH];
+
+// The rectangle defined by Kings on k0 and k1 at the corners
+static inline bitboard_t king_rect_bb(square_t k0, square_t k1) {
+  return files_between_bb[fil_of(k0)][fil_of(k1)] &
+         ranks_between_bb[rnk_of(k0)][rnk_of(k1)];
+}
+
+// Number of Pawns of color c in the rectangle defined by the Kings at the
+// corners
+static inline int pawns_between(position_t * p, color_t c) {
+  return bb_popcount(pawns_bb_of(p, c) &
+                     king_rect_bb(p->kloc[WHITE], p->kloc[BLACK]));
+}
+
+// PBETWEEN heuristic: Bonus for each Pawn of color c in the rectangle defined
+// by the Kings at the corners
+ev_score_t pbetween(position_t * p, color_t c) {
+  return pawns_between(p, c) * PBETWEEN;
+}
+
+// How far the King on (f, r) with orientation ori faces toward the other King
+// on (of, _or), in squares
+static int kface_bonus(fil_t f, rnk_t r, int ori, fil_t of, rnk_t _or) {
+  int delta_fil = of - f;
+  int delta_rnk = _or - r;
   int bonus;
 
-  switch (ori_of(x)) {
+  switch (ori) {
     case NN:
       bonus = delta_rnk;
       break;
@@ -109,21 +109,18 @@ ev_score_t kface(position_t * p, fil_t f, rnk_t r) {
       bonus = 0;
       tbassert(false, "Illegal King orientation.\n");
   }
-
-  return (bonus * KFACE) / (abs(delta_rnk) + abs(delta_fil));
+  return bonus;
 }
 
-// KAGGRESSIVE heuristic: bonus for King with more space to back
-ev_score_t kaggressive(position_t * p, fil_t f, rnk_t r) {
-  square_t sq = square_table[f][r];
-  piece_t x = p->board[sq];
-  color_t c = color_of(x);
-  tbassert(ptype_of(x) == KING, "ptype_of(x) = %d, sq = %d\n", ptype_of(x), sq);
-
-  square_t opp_sq = p->kloc[opp_color(c)];
-  fil_t of = fil_of(opp_sq);
-  rnk_t _or = (rnk_t) rnk_of(opp_sq);
+// KFACE heuristic: bonus (or penalty) for King on (f, r) facing toward the
+// other King on (of, _or)
+ev_score_t kface(fil_t f, rnk_t r, int ori, fil_t of, rnk_t _or) {
+  int dist = abs(_or - r) + abs(of - f);
+  return (kface_bonus(f, r, ori, of, _or) * KFACE) / dist;
+}
 
+// The area behind the King on (f, r), away from the other King on (of, _or)
+static int kaggressive_bonus(fil_t f, rnk_t r, fil_t of, rnk_t _or) {
   int delta_fil = of - f;
   int delta_rnk = _or - r;
 
@@ -138,521 +135,355 @@ ev_score_t kaggressive(position_t * p, fil_t f, rnk_t r) {
   } else if (delta_fil >= 0 && delta_rnk <= 0) {
     bonus = (f + 1) * (BOARD_WIDTH - r);
   }
-
-  return (KAGGRESSIVE * bonus) / BOARD_SIZE;
-}
-
-float h_dist_table[BOARD_WIDTH][BOARD_WIDTH] = {
-  {
-   2.000000000000000000000e+00,
-   1.500000000000000000000e+00,
-   1.333333333333333259318e+00,
-   1.250000000000000000000e+00,
-   1.199999999999999955591e+00,
-   1.166666666666666740682e+00,
-   1.142857142857142793702e+00,
-   1.125000000000000000000e+00},
-  {
-   1.500000000000000000000e+00,
-   1.000000000000000000000e+00,
-   8.333333333333332593185e-01,
-   7.500000000000000000000e-01,
-   6.999999999999999555911e-01,
-   6.666666666666666296592e-01,
-   6.428571428571427937015e-01,
-   6.250000000000000000000e-01},
-  {
-   1.333333333333333259318e+00,
-   8.333333333333332593185e-01,
-   6.666666666666666296592e-01,
-   5.833333333333332593185e-01,
-   5.333333333333333259318e-01,
-   5.000000000000000000000e-01,
-   4.761904761904761640423e-01,
-   4.583333333333333148296e-01},
-  {
-   1.250000000000000000000e+00,
-   7.500000000000000000000e-01,
-   5.833333333333332593185e-01,
-   5.000000000000000000000e-01,
-   4.500000000000000111022e-01,
-   4.166666666666666296592e-01,
-   3.928571428571428492127e-01,
-   3.750000000000000000000e-01},
-  {
-   1.199999999999999955591e+00,
-   6.999999999999999555911e-01,
-   5.333333333333333259318e-01,
-   4.500000000000000111022e-01,
-   4.000000000000000222045e-01,
-   3.666666666666666962726e-01,
-   3.428571428571428603149e-01,
-   3.250000000000000111022e-01},
-  {
-   1.166666666666666740682e+00,
-   6.666666666666666296592e-01,
-   5.000000000000000000000e-01,
-   4.166666666666666296592e-01,
-   3.666666666666666962726e-01,
-   3.333333333333333148296e-01,
-   3.095238095238095343831e-01,
-   2.916666666666666296592e-01},
-  {
-   1.142857142857142793702e+00,
-   6.428571428571427937015e-01,
-   4.761904761904761640423e-01,
-   3.928571428571428492127e-01,
-   3.428571428571428603149e-01,
-   3.095238095238095343831e-01,
-   2.857142857142856984254e-01,
-   2.678571428571428492127e-01},
-  {
-   1.125000000000000000000e+00,
-   6.250000000000000000000e-01,
-   4.583333333333333148296e-01,
-   3.750000000000000000000e-01,
-   3.250000000000000111022e-01,
-   2.916666666666666296592e-01,
-   2.678571428571428492127e-01,
-   2.500000000000000000000e-01}
-};
-
-
-// indices of board borders
-int edges[NUM_SENTINELS] = {
-  0, 1, 2, 3, 4, 5,
-  6, 7, 8, 9, 10, 19,
-  20, 29, 30, 39, 40, 49,
-  50, 59, 60, 69, 70, 79,
-  80, 89, 90, 91, 92, 93,
-  94, 95, 96, 97, 98, 99
-};
-
-
-// Harmonic-ish distance: 1/(|dx|+1) + 1/(|dy|+1)
-static inline float h_dist(square_t a, square_t b) {
-  //  printf("a = %d, FIL(a) = %d, RNK(a) = %d\n", a, FIL(a), RNK(a));
-  //  printf("b = %d, FIL(b) = %d, RNK(b) = %d\n", b, FIL(b), RNK(b));
-  int delta_fil = abs(fil_of(a) - fil_of(b));
-  int delta_rnk = abs(rnk_of(a) - rnk_of(b));
-  //tbassert(h_dist_table[delta_fil][delta_rnk] ==
-  //         (1.0 / (delta_fil + 1)) + (1.0 / (delta_rnk + 1)), "\n");
-  return h_dist_table[delta_fil][delta_rnk];
+  return bonus;
 }
 
-// Same as mark_laser_path(), except also computes heuristics.
-void mark_laser_path_with_heuristics(position_t * p, color_t c, char *laser_map,
-                                     char mark_mask, float *squares_attackable,
-                                     int *num_enemy_pinned_pawns) {
-
-  square_t sq = p->kloc[c];
-  square_t o_king_sq = p->kloc[opp_color(c)];
-  int bdir = ori_of(p->board[sq]);
+// KAGGRESSIVE heuristic: bonus for King on (f, r) with more space to back,
+// away from the other King on (of, _or)
+ev_score_t kaggressive(fil_t f, rnk_t r, fil_t of, rnk_t _or) {
+  return (KAGGRESSIVE * kaggressive_bonus(f, r, of, _or)) / BOARD_SIZE;
+}
 
-  tbassert(ptype_of(p->board[sq]) == KING,
-           "ptype: %d\n", ptype_of(p->board[sq]));
-  tbassert(ptype_of(p->board[o_king_sq]) == KING,
-           "ptype: %d\n", ptype_of(p->board[o_king_sq]));
-  tbassert(color_of(p->board[o_king_sq]) != c,
-           "color: %d\n", color_of(p->board[o_king_sq]));
-
-  laser_map[sq] |= mark_mask;
-  *squares_attackable = h_dist(sq, o_king_sq) + EPSILON;
-
-  char prev_state;
-  while (true) {
-    sq += beam[bdir];           //beam_of(bdir);
-    prev_state = laser_map[sq];
-    laser_map[sq] |= mark_mask;
-    tbassert(sq < ARR_SIZE && sq >= 0, "sq: %d\n", sq);
-
-    switch (ptype_of(p->board[sq])) {
-      case EMPTY:              // empty square
-        if (prev_state == 0) {
-          *squares_attackable += h_dist(sq, o_king_sq);
-        }
-        break;
-      case PAWN:               // Pawn
-        if (prev_state == 0) {
-          *squares_attackable += h_dist(sq, o_king_sq);
-        }
-        if (c != color_of(p->board[sq])) {
-          // pinned an enemy pawn!
-          ++(*num_enemy_pinned_pawns);
-        }
-        // int oldbdir = bdir;
-        bdir = reflect[bdir][ori_of(p->board[sq])];
-        // tbassert (bdir == reflect_of(oldbdir, ori_of(p->board[sq])), "\n");
-        if (bdir < 0) {         // Hit back of Pawn
-          return;
-        }
-        break;
-      case KING:               // King
-        if (prev_state == 0) {
-          *squares_attackable += h_dist(sq, o_king_sq);
+// king_table[k][o][ori] = KFACE + KAGGRESSIVE for a King on bitboard index k,
+// facing ori, with the other King on o.  Filled in by init_eval_tables().
+ev_score_t king_table[BOARD_SIZE][BOARD_SIZE][NUM_ORI];
+
+// h_dist_table[df][dr] = (1/(df+1) + 1/(dr+1)) * H_DIST_SCALE, filled in by
+// init_eval_tables().
+int32_t h_dist_table[BOARD_WIDTH][BOARD_WIDTH];
+
+// max_attackable[k]: the H_SQUARES_ATTACKABLE value of a laser that passed
+// every square of the board, with the enemy King on bitboard index k.  No
+// laser path scores more.  Filled in by init_eval_tables().
+int max_attackable[BOARD_SIZE];
+
+// Fills in the tables that depend on the board geometry.  pcentral_table,
+// pawn_ev_table and king_table also depend on the PCENTRAL, KFACE and
+// KAGGRESSIVE weights, so this runs again when one of those options changes.
+void init_eval_tables() {
+  for (fil_t f = 0; f < BOARD_WIDTH; f++) {
+    for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
+      pcentral_table[f][r] = pcentral(f, r);
+      pawn_ev_table[square_at(f, r)] = PAWN_EV_VALUE + pcentral_table[f][r];
+      h_dist_table[f][r] = H_DIST_SCALE / (f + 1) + H_DIST_SCALE / (r + 1);
+
+      for (fil_t of = 0; of < BOARD_WIDTH; of++) {
+        for (rnk_t _or = 0; _or < BOARD_WIDTH; _or++) {
+          for (int ori = 0; ori < NUM_ORI; ori++) {
+            // the Kings are never on the same square
+            king_table[bb_index(f, r)][bb_index(of, _or)][ori] =
+                (f == of && r == _or) ? 0 :
+                kface(f, r, ori, of, _or) + kaggressive(f, r, of, _or);
+          }
         }
-        return;                 // sorry, game over my friend!
-        break;
-      case INVALID:            // Ran off edge of board
-        return;
-        break;
-      default:                 // Shouldna happen, man!
-        tbassert(false, "Not cool, man.  Not cool.\n");
-        break;
+      }
     }
   }
-}
 
-// Marks the path/line-of-sight of the laser until it hits a piece or goes off
-// the board.
-//
-// p : Current board state.
-// c : Color of king shooting laser.
-// laser_map : End result will be stored here. Every square on the
-//             path of the laser is marked with mark_mask.
-// mark_mask : What each square is marked with.
-extern inline void mark_laser_path(position_t * p, color_t c, char *laser_map,
-                                   char mark_mask) {
-
-  square_t sq = p->kloc[c];
-  int bdir = ori_of(p->board[sq]);
-
-  tbassert(ptype_of(p->board[sq]) == KING,
-           "ptype: %d\n", ptype_of(p->board[sq]));
-  laser_map[sq] |= mark_mask;
-
-  while (true) {
-    sq += beam[bdir];           // beam_of(bdir);
-    laser_map[sq] |= mark_mask;
-    tbassert(sq < ARR_SIZE && sq >= 0, "sq: %d\n", sq);
-
-    switch (ptype_of(p->board[sq])) {
-      case EMPTY:              // empty square
-        break;
-      case PAWN:               // Pawn
-        bdir = reflect[bdir][ori_of(p->board[sq])];
-        // tbassert (newbdir == reflect_of(bdir, ori_of(p->board[sq])), "\n");
-        // bdir = newbdir;
-        if (bdir < 0) {         // Hit back of Pawn
-          return;
-        }
-        break;
-      case KING:               // King
-        return;                 // sorry, game over my friend!
-        break;
-      case INVALID:            // Ran off edge of board
-        return;
-        break;
-      default:                 // Shouldna happen, man!
-        tbassert(false, "Not cool, man.  Not cool.\n");
-        break;
+  for (int k = 0; k < BOARD_SIZE; k++) {
+    int32_t h_attackable = 0;
+    for (int i = 0; i < BOARD_SIZE; i++) {
+      h_attackable += h_dist_table[abs(i / BOARD_WIDTH - k / BOARD_WIDTH)]
+                                  [abs(i % BOARD_WIDTH - k % BOARD_WIDTH)];
     }
+    max_attackable[k] = h_attackable / H_DIST_SCALE;
   }
-}
 
-// generate piece_list along the path/line-of-sight of the laser until it hits a piece or goes off
-// the board.
-//
-// p : Current board state.
-// c : Color of king shooting laser.
-// piece_list: the list of pieces along the laser path
-// return the size of piece_list
-int generate_pieces_along_laser_path(position_t * p, color_t c, square_t* piece_list) {
-  int piece_count = 0;
-  square_t current_loc = p->kloc[c];
-  int laser_dir = ori_of(p->board[current_loc]);
-  piece_list[piece_count++] = current_loc;
-
-  while (true) {
-    square_t original_loc = current_loc;
-    current_loc = next_piece(p, current_loc, laser_dir);
-    tbassert(current_loc < ARR_SIZE
-             && current_loc >= 0, "current_loc: %d\n", current_loc);
-
-    piece_t current_piece = ptype_of(p->board[current_loc]);
-
-    if (current_piece == PAWN) {
-      // laser_dir = reflect_of(laser_dir, ori_of(p->board[current_loc]));
-      // int olddir = laser_dir;
-      laser_dir = reflect[laser_dir][ori_of(p->board[current_loc])];
-      piece_list[piece_count++] = current_loc;
-
-      // tbassert(laser_dir == reflect_of(olddir, ori_of(p->board[current_loc])), "\n");
-      if (laser_dir < 0) {      // Hit back of Pawn
-        piece_list[piece_count] = -1;
-        return piece_count;
-      }
-    } else if (current_piece == KING) { // hit KING
-      piece_list[piece_count++] = current_loc;
-      piece_list[piece_count] = -1;
-      return piece_count;
-    } else {
-      square_t next_loc = original_loc + beam[laser_dir];
-      if (ptype_of(p->board[next_loc]) == EMPTY) {
-        int rank = rnk_of(original_loc);
-        int file = fil_of(original_loc);
-        switch (laser_dir) {
-          case NN: {
-            piece_list[piece_count] = original_loc + 7 - rank;
-            //piece_list[piece_count + 1] = next_loc;
-            //piece_list[piece_count + 2] = laser_dir;
-            break;
-          }
-          case SS: {
-            piece_list[piece_count] = original_loc - rank;
-            //piece_list[piece_count + 1] = next_loc;
-            //piece_list[piece_count + 2] = laser_dir;
-            break;
-          }
-          case WW: {
-            piece_list[piece_count] = original_loc - file * ARR_WIDTH;
-            //piece_list[piece_count + 1] = next_loc;
-            //piece_list[piece_count + 2] = laser_dir;
-            //piece_list[piece_count + 3] = file;
-            break;
-          }
-          case EE: {
-            piece_list[piece_count] = original_loc + (7 - file) * ARR_WIDTH;
-            //piece_list[piece_count + 1] = next_loc;
-            //piece_list[piece_count + 2] = laser_dir;
-            //piece_list[piece_count + 3] = file;
-            break;
-          }
-        }
-        return piece_count;
-      } else {
-        piece_list[piece_count] = -1;
-        return piece_count;
+  for (int i = 0; i < BOARD_WIDTH; i++) {
+    for (int j = 0; j < BOARD_WIDTH; j++) {
+      files_between_bb[i][j] = 0;
+      ranks_between_bb[i][j] = 0;
+      for (int k = (i < j) ? i : j; k <= ((i < j) ? j : i); k++) {
+        files_between_bb[i][j] |= file_bb(k);
+        ranks_between_bb[i][j] |= rank_bb(k);
       }
     }
   }
 }
 
-// p : Current board state.
-// c : Color of king shooting laser.
-// pinned_pawn_list: all the pawns of the opposite side pinned by color c's king
-// return number of the pawns pinned, i.e. the length of pinned_pawn_list
-int generate_pinned_pawn_list(position_t * p, color_t c,
-                              square_t * pinned_pawn_list) {
-  tbassert(pinned_pawn_list, "\n");
-
-  int pinned_pawn_count = 0;
-  square_t current_loc = p->kloc[c];
-
-  tbassert(ptype_of(p->board[current_loc]) == KING,
-           "ptype: %d\n", ptype_of(p->board[current_loc]));
+// KFACE and KAGGRESSIVE heuristics for the King of color c
+static inline ev_score_t king_terms(position_t * p, color_t c) {
+  square_t k = p->kloc[c];
+  square_t o = p->kloc[opp_color(c)];
+  tbassert(ptype_of(p->board[k]) == KING, "ptype: %d\n", ptype_of(p->board[k]));
+  return king_table[bb_index(fil_of(k), rnk_of(k))]
+                   [bb_index(fil_of(o), rnk_of(o))][ori_of(p->board[k])];
+}
 
-  int laser_dir = ori_of(p->board[current_loc]);
-  piece_t current_piece;
-  color_t opposite_color = opp_color(c);
+// Computes the Pawn sums of p from scratch.
+void init_ev_terms(position_t * p) {
+  for (color_t c = WHITE; c <= BLACK; c++) {
+    p->ev.pawn[c] = 0;
+    for (bitboard_t pawns = pawns_bb_of(p, c); pawns != 0;
+         pawns &= pawns - 1) {
+      p->ev.pawn[c] += pawn_ev_table[bb_square(bb_ctz(pawns))];
+    }
+  }
+}
 
-  while (true) {
-    current_loc = next_piece(p, current_loc, laser_dir);
-    //current_loc += beam[laser_dir];
-    tbassert(current_loc < ARR_SIZE
-             && current_loc >= 0, "current_loc: %d\n", current_loc);
+// Debugging function: checks that the running eval sums of p are the ones
+// init_ev_terms() would compute.
+bool ev_terms_are_current(position_t * p) {
+  position_t q = *p;
+  init_ev_terms(&q);
+  return q.ev.pawn[WHITE] == p->ev.pawn[WHITE] &&
+         q.ev.pawn[BLACK] == p->ev.pawn[BLACK];
+}
 
-    current_piece = ptype_of(p->board[current_loc]);
+// Harmonic-ish distance: 1/(|dx|+1) + 1/(|dy|+1), in units of 1/H_DIST_SCALE
+static inline int32_t h_dist(square_t a, square_t b) {
+  //  printf("a = %d, FIL(a) = %d, RNK(a) = %d\n", a, FIL(a), RNK(a));
+  //  printf("b = %d, FIL(b) = %d, RNK(b) = %d\n", b, FIL(b), RNK(b));
+  int delta_fil = abs(fil_of(a) - fil_of(b));
+  int delta_rnk = abs(rnk_of(a) - rnk_of(b));
+  return h_dist_table[delta_fil][delta_rnk];
+}
 
-    if (current_piece == PAWN) {
-      // laser_dir = reflect_of(laser_dir, ori_of(p->board[current_loc]));
-      // int olddir = laser_dir;
-      laser_dir = reflect[laser_dir][ori_of(p->board[current_loc])];
-      // tbassert(laser_dir == reflect_of(olddir, ori_of(p->board[current_loc])), "\n");
-      if (laser_dir < 0) {      // Hit back of Pawn
-        return pinned_pawn_count;
-      }
+// H_SQUARES_ATTACKABLE heuristic over the laser path of color c: how close
+// the squares it passes are to the enemy King, rounded down.
+static inline int laser_attackable(position_t * p, color_t c) {
+  square_t o_king_sq = p->kloc[opp_color(c)];
+  tbassert(ptype_of(p->board[o_king_sq]) == KING,
+           "ptype: %d\n", ptype_of(p->board[o_king_sq]));
 
-      if (color_of(p->board[current_loc]) == opposite_color) {
-        pinned_pawn_list[pinned_pawn_count++] = current_loc;
-      }
-    } else if ((current_piece == INVALID) || (current_piece == KING)) { // Ran off edge of board or hit KING
-      return pinned_pawn_count;
-    }
+  int32_t h_attackable = 0;
+  for (bitboard_t path = laser_path_bb(p, c); path != 0; path &= path - 1) {
+    h_attackable += h_dist(bb_square(bb_ctz(path)), o_king_sq);
   }
+  return h_attackable / H_DIST_SCALE;
 }
 
-// PAWNPIN Heuristic: count number of pawns that are not pinned by the
-//   opposing king's laser --- and are thus mobile.
-int pawnpin(position_t * p, color_t c, square_t* piece_list, int piece_count) {
-  int unpinned_pawns = p->ploc[c].pawns_count;
-  for (int i = 1; i < piece_count; i++) {
-    if (ptype_of(p->board[piece_list[i]]) == PAWN && color_of(p->board[piece_list[i]]) == c) {
-      unpinned_pawns--;
-    }
-  }
-  return unpinned_pawns;
+// Number of times the laser of color c reaches a pawn of the other color,
+// either reflecting off it or zapping it.
+static inline int laser_pawns_hit(position_t * p, color_t c) {
+  generate_pinned_pawns(p, c);  // make sure the laser has been traced
+  square_t hit = p->laser.hit[c];
+  return bb_popcount(p->laser.pinned[c]) +
+         (hit != 0 && ptype_of(p->board[hit]) == PAWN &&
+          color_of(p->board[hit]) != c);
 }
 
-int get_king_mobility(position_t * p, char *laser_map, color_t color) {
-  square_t king_sq = p->kloc[color];
-  int mobility = 0;
-  if (laser_map[king_sq] == 0) {
-    mobility++;
-  }
-  for (int d = 0; d < 8; ++d) {
-    square_t sq = king_sq + dir_of(d);
-    if (laser_map[sq] == 0) {
-      mobility++;
-    }
-  }
-  return mobility;
+// MOBILITY heuristic: safe squares around the King of color color, off the
+// laser path of the other color.
+int get_king_mobility(position_t * p, bitboard_t laser_path, color_t color) {
+  bitboard_t safe = king_area_bb(p->kloc[color]) & ~laser_path;
+  return bb_popcount(safe);
 }
 
-int king_mobility(position_t * p, color_t c, square_t* piece_list, int piece_count) {
-  int mobility = 0;
-  square_t king_sq = p->kloc[c];
-  mobility++;
+// -----------------------------------------------------------------------------
+// Eval statistics
+//
+// Built with EVAL_STATS defined (make EVALSTATS=1), eval() counts for each
+// term how often it is computed, the cycles that takes, and the values it
+// adds to the score of one side; "evalstats" prints the totals.  Cycles come
+// from unserialized rdtsc reads, so they are estimates for terms that only
+// cost a few cycles.  Otherwise EV_TERM() is just the term itself.
+// -----------------------------------------------------------------------------
 
-  int num_iter = piece_count - 1;
-  if (piece_list[piece_count] != -1 ) {
-    num_iter++;
-  }
+typedef enum {
+  EV_PAWNS,     // MATERIAL and PCENTRAL, kept as running sums
+  EV_KINGS,     // KFACE and KAGGRESSIVE, looked up in king_table
+  EV_PBETWEEN,
+  EV_TRACE,     // tracing a laser that is not known yet; no value
+  EV_HATTACK,
+  EV_MOBILITY,
+  EV_PAWNPIN,
+  NUM_EV_TERMS
+} ev_term_t;
+
+#ifdef EVAL_STATS
+
+#include <string.h>
+#include <x86intrin.h>
+
+static const char *ev_term_name[NUM_EV_TERMS] = {
+  "MATERIAL+PCENTRAL", "KFACE+KAGGRESSIVE", "PBETWEEN", "laser trace",
+  "HATTACK", "MOBILITY", "PAWNPIN"
+};
 
-  for (int i = 0; i < num_iter; i++) {
-    square_t first_sq = piece_list[i];
-    square_t next_sq = piece_list[i + 1];
-    if (between(rnk_of(king_sq), rnk_of(first_sq), rnk_of(next_sq)) && between(fil_of(king_sq), fil_of(first_sq), fil_of(next_sq))) {
-      mobility--;
-      break;
-    }
+typedef struct ev_stat {
+  uint64_t calls;
+  uint64_t cycles;
+  uint64_t nonzero;
+  int64_t sum;
+  double sum_sq;
+  ev_score_t min;
+  ev_score_t max;
+} ev_stat_t;
+
+// Each thread records into a slot of its own, so that no locking is needed.
+// Threads beyond the last slot share it and may lose counts.
+#define EV_STATS_SLOTS 64
+
+static ev_stat_t ev_stats[EV_STATS_SLOTS][NUM_EV_TERMS];
+static int ev_stats_slots_used = 0;
+static __thread int ev_stats_slot = -1;
+
+static void ev_stat_add(ev_term_t term, ev_score_t value, uint64_t cycles) {
+  if (ev_stats_slot < 0) {
+    int slot = __sync_fetch_and_add(&ev_stats_slots_used, 1);
+    ev_stats_slot = (slot < EV_STATS_SLOTS) ? slot : EV_STATS_SLOTS - 1;
   }
-
-  for (int d = 0; d < 8; ++d) {
-    square_t sq = king_sq + dir_of(d);
-    if (ptype_of(p->board[sq]) != INVALID) {  // outside the board
-      mobility++;
-      for (int i = 0; i < num_iter; i++) {
-        square_t first_sq = piece_list[i];
-        square_t next_sq = piece_list[i + 1];
-        if (between(rnk_of(sq), rnk_of(first_sq), rnk_of(next_sq)) && between(fil_of(sq), fil_of(first_sq), fil_of(next_sq))) {
-          mobility--;
-          break;
-        }
-      }
-    }
+  ev_stat_t *st = &ev_stats[ev_stats_slot][term];
+  if (st->calls == 0 || value < st->min) {
+    st->min = value;
+  }
+  if (st->calls == 0 || value > st->max) {
+    st->max = value;
   }
-  return mobility;
+  st->calls++;
+  st->cycles += cycles;
+  st->nonzero += (value != 0);
+  st->sum += value;
+  st->sum_sq += (double) value * value;
 }
 
+#define EV_TERM(term, expr) ({                            \
+      uint64_t ev_t0_ = __rdtsc();                        \
+      ev_score_t ev_v_ = (expr);                          \
+      ev_stat_add((term), ev_v_, __rdtsc() - ev_t0_);     \
+      ev_v_; })
+
+#define EV_TRACE_LASER(p, c)                              \
+  if (!laser_known((p), (c))) {                           \
+    uint64_t ev_t0_ = __rdtsc();                          \
+    laser_path_bb((p), (c));                              \
+    ev_stat_add(EV_TRACE, 0, __rdtsc() - ev_t0_);         \
+  }
 
-// MOBILITY heuristic: safe squares around king of given color.
-int mobility(position_t * p, color_t color) {
-  color_t c = opp_color(color);
-  char laser_map[ARR_SIZE];
+void eval_stats_reset() {
+  memset(ev_stats, 0, sizeof(ev_stats));
+}
 
-  // manually set the border
-  // laser_map_edges(laser_map);
-  for (int i = 0; i < NUM_SENTINELS; i++) {
-    laser_map[edges[i]] = 4;
+void eval_stats_report() {
+  // cycles of an empty timed region, taken off the cycles of each call
+  uint64_t overhead = UINT64_MAX;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t t0 = __rdtsc();
+    uint64_t t1 = __rdtsc();
+    overhead = (t1 - t0 < overhead) ? t1 - t0 : overhead;
   }
 
-  for (fil_t f = 0; f < BOARD_WIDTH; ++f) {
-    for (rnk_t r = 0; r < BOARD_WIDTH; ++r) {
-      laser_map[square_table[f][r]] = 0;
+  printf("info string %-18s %12s %8s %9s %9s %9s %9s %8s\n", "term", "calls",
+         "cycles", "mean", "stddev", "min", "max", "nonzero");
+  for (int t = 0; t < NUM_EV_TERMS; t++) {
+    ev_stat_t tot = { 0 };
+    for (int i = 0; i < EV_STATS_SLOTS; i++) {
+      ev_stat_t *st = &ev_stats[i][t];
+      if (st->calls == 0) {
+        continue;
+      }
+      if (tot.calls == 0 || st->min < tot.min) {
+        tot.min = st->min;
+      }
+      if (tot.calls == 0 || st->max > tot.max) {
+        tot.max = st->max;
+      }
+      tot.calls += st->calls;
+      tot.cycles += st->cycles;
+      tot.nonzero += st->nonzero;
+      tot.sum += st->sum;
+      tot.sum_sq += st->sum_sq;
+    }
+    if (tot.calls == 0) {
+      printf("info string %-18s %12d\n", ev_term_name[t], 0);
+      continue;
     }
-  }
-
-  mark_laser_path(p, c, laser_map, 1);  // find path of laser given that you aren't moving
-
-  int mobility = 0;
-  square_t king_sq = p->kloc[color];
-  tbassert(ptype_of(p->board[king_sq]) == KING,
-           "ptype: %d\n", ptype_of(p->board[king_sq]));
-  tbassert(color_of(p->board[king_sq]) == color,
-           "color: %d\n", color_of(p->board[king_sq]));
 
-  if (laser_map[king_sq] == 0) {
-    mobility++;
-  }
-  for (int d = 0; d < 8; ++d) {
-    square_t sq = king_sq + dir_of(d);
-    if (laser_map[sq] == 0) {
-      mobility++;
+    double n = tot.calls;
+    double cycles = (double) tot.cycles / n - overhead;
+    if (t == EV_TRACE) {
+      printf("info string %-18s %12" PRIu64 " %8.1f\n", ev_term_name[t],
+             tot.calls, cycles > 0 ? cycles : 0);
+      continue;
     }
+    // values in score_t units
+    double mean = tot.sum / n;
+    double var = tot.sum_sq / n - mean * mean;
+    printf("info string %-18s %12" PRIu64 " %8.1f %9.2f %9.2f %9.2f %9.2f"
+           " %7.1f%%\n", ev_term_name[t], tot.calls, cycles > 0 ? cycles : 0,
+           mean / EV_SCORE_RATIO,
+           (var > 0 ? sqrt(var) : 0) / EV_SCORE_RATIO,
+           (double) tot.min / EV_SCORE_RATIO,
+           (double) tot.max / EV_SCORE_RATIO, 100.0 * tot.nonzero / n);
   }
-  return mobility;
+  printf("info string values are per side, in score units; cycles are per "
+         "call, less %" PRIu64 " of timer overhead\n", overhead);
 }
 
-// H_SQUARES_ATTACKABLE heuristic: for shooting the enemy king
-float h_squares_attackable(position_t * p, color_t c, square_t* piece_list, int piece_count) {
-  square_t o_king_sq = p->kloc[opp_color(c)];
-  tbassert(ptype_of(p->board[o_king_sq]) == KING,
-           "ptype: %d\n", ptype_of(p->board[o_king_sq]));
-  tbassert(color_of(p->board[o_king_sq]) != c,
-           "color: %d\n", color_of(p->board[o_king_sq]));
+#else
 
-  float h_attackable = EPSILON;
+#define EV_TERM(term, expr) (expr)
+#define EV_TRACE_LASER(p, c)
 
-  for (int i = 0; i < piece_count; i++) {
-    h_attackable += h_dist(piece_list[i], o_king_sq);
-  }
-
-  return h_attackable;
+void eval_stats_reset() {
 }
 
-// Static evaluation.  Returns score
-/*score_t eval(position_t * p, bool verbose) {
-  // seed rand_r with a value of 1, as per
-  // http://linux.die.net/man/3/rand_r
-  static __thread unsigned int seed = 1;
-  // verbose = true: print out components of score
-  ev_score_t score[2] = { 0, 0 };
-  //  int corner[2][2] = { {INF, INF}, {INF, INF} };
-
-  for (int c = 0; c < 2; ++c) {
+void eval_stats_report() {
+  printf("info string evalstats needs a build with EVALSTATS=1\n");
+}
 
-    // Pawn heuristics
-    for (int i = 0; i < p->ploc[c].pawns_count; ++i) {
-      fil_t f = fil_of(p->ploc[c].squares[i]);
-      rnk_t r = rnk_of(p->ploc[c].squares[i]);
+#endif  // EVAL_STATS
 
-      // PBETWEEN heuristic
-      score[c] += pbetween(p, f, r);
+// Terms of the static evaluation that do not need the lasers, for each color.
+static inline void eval_static_terms(position_t * p, ev_score_t score[2]) {
+  tbassert(ev_terms_are_current(p), "stale eval sums\n");
 
-      // PCENTRAL heuristic
-      score[c] += pcentral_table[f][r];
-      tbassert(pcentral_table[f][r] == pcentral(f, r), "\n");
-    }
+  // the Pawns of both colors between the Kings, for PBETWEEN
+  bitboard_t between = p->pawn_bb & king_rect_bb(p->kloc[WHITE],
+                                                  p->kloc[BLACK]);
 
-    // King heuristics
-    fil_t f = fil_of(p->kloc[c]);
-    rnk_t r = rnk_of(p->kloc[c]);
+  for (int c = 0; c < 2; ++c) {
+    // MATERIAL and PCENTRAL heuristics, summed up as moves are made
+    score[c] += EV_TERM(EV_PAWNS, p->ev.pawn[c]);
 
-    // KFACE heuristic
-    score[c] += kface(p, f, r);
+    // KFACE and KAGGRESSIVE heuristics
+    score[c] += EV_TERM(EV_KINGS, king_terms(p, c));
 
-    // KAGGRESSIVE heuristic
-    score[c] += kaggressive(p, f, r);
+    // PBETWEEN heuristic
+    score[c] += EV_TERM(EV_PBETWEEN,
+                        PBETWEEN * bb_popcount(between & p->color_bb[c]));
   }
- 
-
-  // MATERIAL heuristic: Bonus for each Pawn
-  score[0] += p->ploc[0].pawns_count * PAWN_EV_VALUE;
-  score[1] += p->ploc[1].pawns_count * PAWN_EV_VALUE;
-
-
-  // Initialize piece_list along the laser path.
-  square_t white_piece_list[MAX_NUM_PIECES];
-  square_t black_piece_list[MAX_NUM_PIECES];
+}
 
-  int white_piece_count = generate_pieces_along_laser_path(p, WHITE, white_piece_list);
-  int black_piece_count = generate_pieces_along_laser_path(p, BLACK, black_piece_list);
+// Terms of the static evaluation that need the laser of color c.
+static inline void eval_laser_terms(position_t * p, color_t c,
+                                    ev_score_t score[2]) {
+  color_t o = opp_color(c);
+  EV_TRACE_LASER(p, c);
 
   // H_SQUARES_ATTACKABLE heuristic
-  score[WHITE] += HATTACK * (int) h_squares_attackable(p, WHITE, white_piece_list, white_piece_count);
-  score[BLACK] += HATTACK * (int) h_squares_attackable(p, BLACK, black_piece_list, black_piece_count);
+  score[c] += EV_TERM(EV_HATTACK, HATTACK * laser_attackable(p, c));
 
-  // MOBILITY heuristic
-  score[WHITE] += MOBILITY * king_mobility(p, WHITE, white_piece_list, white_piece_count);
-  score[BLACK] += MOBILITY * king_mobility(p, BLACK, black_piece_list, black_piece_count);
+  // MOBILITY heuristic: safe squares around the enemy King
+  score[o] += EV_TERM(EV_MOBILITY,
+                      MOBILITY * get_king_mobility(p, laser_path_bb(p, c), o));
 
   // PAWNPIN heuristic --- is a pawn immobilized by the enemy laser.
-  score[WHITE] += PAWNPIN * pawnpin(p, WHITE, white_piece_list, white_piece_count);
-  score[BLACK] += PAWNPIN * pawnpin(p, BLACK, black_piece_list, black_piece_count);
+  score[o] += EV_TERM(EV_PAWNPIN,
+                      PAWNPIN * (pawns_count_of(p, o) - laser_pawns_hit(p, c)));
+}
 
-  // score from WHITE point of view
-  ev_score_t tot = score[WHITE] - score[BLACK];
+// Bounds on what eval_laser_terms() can add to the score of color c minus
+// the score of the other color.  Each term is a nonnegative weight times a
+// count: HATTACK at most the sum of h_dist over the whole board, MOBILITY
+// the squares around the enemy King, and PAWNPIN the enemy Pawns.
+static inline ev_score_t max_laser_terms(position_t * p, color_t c) {
+  square_t o = p->kloc[opp_color(c)];
+  return HATTACK * max_attackable[bb_index(fil_of(o), rnk_of(o))];
+}
+
+static inline ev_score_t min_laser_terms(position_t * p, color_t c) {
+  color_t o = opp_color(c);
+  return -(MOBILITY * bb_popcount(king_area_bb(p->kloc[o])) +
+           PAWNPIN * pawns_count_of(p, o));
+}
+
+// Score from the point of view of the side to move, in score_t units.
+static inline score_t eval_finish(position_t * p, ev_score_t tot) {
+  // seed rand_r with a value of 1, as per
+  // http://linux.die.net/man/3/rand_r
+  static __thread unsigned int seed = 1;
 
   if (RANDOMIZE) {
     ev_score_t z = rand_r(&seed) % (RANDOMIZE * 2 + 1);
@@ -664,111 +495,257 @@ float h_squares_attackable(position_t * p, color_t c, square_t* piece_list, int
   }
 
   return tot / EV_SCORE_RATIO;
-}*/
+}
+
+// Prints every term of the static evaluation of p for both colors, in score_t
+// units, each computed on its own from its definition.  tot is what eval()
+// summed up, from WHITE point of view.
+static void print_eval_terms(position_t * p, ev_score_t tot) {
+  enum { MATERIAL_T, PCENTRAL_T, PBETWEEN_T, KFACE_T, KAGGRESSIVE_T, HATTACK_T,
+         MOBILITY_T, PAWNPIN_T, NUM_TERMS };
+  static const char *name[NUM_TERMS] = {
+    "MATERIAL", "PCENTRAL", "PBETWEEN", "KFACE", "KAGGRESSIVE", "HATTACK",
+    "MOBILITY", "PAWNPIN"
+  };
+  ev_score_t term[NUM_TERMS][2];
+  ev_score_t sum[2] = { 0, 0 };
+
+  for (color_t c = WHITE; c <= BLACK; c++) {
+    color_t o = opp_color(c);
+    square_t k = p->kloc[c];
+    square_t ok = p->kloc[o];
+
+    term[MATERIAL_T][c] = PAWN_EV_VALUE * pawns_count_of(p, c);
+    term[PCENTRAL_T][c] = 0;
+    for (bitboard_t pawns = pawns_bb_of(p, c); pawns != 0;
+         pawns &= pawns - 1) {
+      square_t sq = bb_square(bb_ctz(pawns));
+      term[PCENTRAL_T][c] += pcentral_table[fil_of(sq)][rnk_of(sq)];
+    }
+    term[PBETWEEN_T][c] = pbetween(p, c);
+    term[KFACE_T][c] = kface(fil_of(k), rnk_of(k), ori_of(p->board[k]),
+                             fil_of(ok), rnk_of(ok));
+    term[KAGGRESSIVE_T][c] = kaggressive(fil_of(k), rnk_of(k),
+                                         fil_of(ok), rnk_of(ok));
+    term[HATTACK_T][c] = HATTACK * laser_attackable(p, c);
+    term[MOBILITY_T][c] =
+        MOBILITY * get_king_mobility(p, laser_path_bb(p, o), c);
+    term[PAWNPIN_T][c] =
+        PAWNPIN * (pawns_count_of(p, c) - laser_pawns_hit(p, o));
+  }
+
+  printf("info string %-12s %9s %9s %9s\n", "term", "White", "Black",
+         "White-Black");
+  for (int t = 0; t < NUM_TERMS; t++) {
+    sum[WHITE] += term[t][WHITE];
+    sum[BLACK] += term[t][BLACK];
+    printf("info string %-12s %9.2f %9.2f %9.2f\n", name[t],
+           (double) term[t][WHITE] / EV_SCORE_RATIO,
+           (double) term[t][BLACK] / EV_SCORE_RATIO,
+           (double) (term[t][WHITE] - term[t][BLACK]) / EV_SCORE_RATIO);
+  }
+  printf("info string %-12s %9.2f %9.2f %9.2f\n", "total",
+         (double) sum[WHITE] / EV_SCORE_RATIO,
+         (double) sum[BLACK] / EV_SCORE_RATIO,
+         (double) (sum[WHITE] - sum[BLACK]) / EV_SCORE_RATIO);
+  tbassert(sum[WHITE] - sum[BLACK] == tot, "terms: %d, eval: %d\n",
+           sum[WHITE] - sum[BLACK], tot);
+}
 
 // Static evaluation.  Returns score
 score_t eval(position_t * p, bool verbose) {
-
-    // seed rand_r with a value of 1, as per
-  // http://linux.die.net/man/3/rand_r
-  static __thread unsigned int seed = 1;
   // verbose = true: print out components of score
   ev_score_t score[2] = { 0, 0 };
-  //  int corner[2][2] = { {INF, INF}, {INF, INF} };
-  //ev_score_t bonus;
-  //char buf[MAX_CHARS_IN_MOVE];
-
-  for (int c = 0; c < 2; ++c) {
 
-    // Pawn heuristics
-    for (int i = 0; i < p->ploc[c].pawns_count; ++i) {
-      fil_t f = fil_of(p->ploc[c].squares[i]);
-      rnk_t r = rnk_of(p->ploc[c].squares[i]);
+  eval_static_terms(p, score);
+  eval_laser_terms(p, WHITE, score);
+  eval_laser_terms(p, BLACK, score);
 
-      // PBETWEEN heuristic
-      score[c] += pbetween(p, f, r);
-
-      // PCENTRAL heuristic
-      score[c] += pcentral_table[f][r];
-      //tbassert(pcentral_table[f][r] == pcentral(f, r), "\n");
-    }
+  if (verbose) {
+    print_eval_terms(p, score[WHITE] - score[BLACK]);
+  }
 
-    // King heuristics
-    fil_t f = fil_of(p->kloc[c]);
-    rnk_t r = rnk_of(p->kloc[c]);
+  // score from WHITE point of view
+  return eval_finish(p, score[WHITE] - score[BLACK]);
+}
 
-    // KFACE heuristic
-    score[c] += kface(p, f, r);
+// Debugging function: eval() of a copy of p, which leaves p as it is.
+static inline score_t eval_of_copy(position_t * p) {
+  position_t q = *p;
+  return eval(&q, false);
+}
 
-    // KAGGRESSIVE heuristic
-    score[c] += kaggressive(p, f, r);
+// Static evaluation for a search that only needs to know how the score
+// compares to the window (alpha, beta).  Lasers that have not been traced
+// yet are only traced if their terms can move the score across the window.
+// Otherwise the result is a bound on the score on the same side of the
+// window: at most alpha if the score is, and at least beta if the score is.
+score_t eval_bounded(position_t * p, score_t alpha, score_t beta) {
+  if (RANDOMIZE) {
+    return eval(p, false);
   }
- 
-  // MATERIAL heuristic: Bonus for each Pawn
-  score[0] += p->ploc[0].pawns_count * PAWN_EV_VALUE;
-  score[1] += p->ploc[1].pawns_count * PAWN_EV_VALUE;
-
-  // Initialize laser map.
-  // char laser_map[2][ARR_SIZE];
-  char white_laser_map[ARR_SIZE];
-  char black_laser_map[ARR_SIZE];
-
-  // fill in invalid squares
-  for (int i = 0; i < NUM_SENTINELS; i++) {
-    white_laser_map[edges[i]] = 4;
-    black_laser_map[edges[i]] = 4;
+
+  ev_score_t score[2] = { 0, 0 };
+  eval_static_terms(p, score);
+
+  // bounds on the terms of the lasers not traced yet, from WHITE point of view
+  ev_score_t lo = 0;
+  ev_score_t hi = 0;
+  bool all_known = true;
+  for (color_t c = WHITE; c <= BLACK; c++) {
+    if (laser_known(p, c)) {
+      eval_laser_terms(p, c, score);
+      continue;
+    }
+    all_known = false;
+    if (c == WHITE) {
+      lo += min_laser_terms(p, c);
+      hi += max_laser_terms(p, c);
+    } else {
+      lo -= max_laser_terms(p, c);
+      hi -= min_laser_terms(p, c);
+    }
   }
-  // for (int i = 0; i < ARR_SIZE; ++i) {
-  //   // Invalid squares
-  //   white_laser_map[i] = 4;
-  //   black_laser_map[i] = 4;
-  // }
-  for (int i = RNK_ORIGIN; i < ARR_WIDTH - 1; ++i) {
-    for (int j = RNK_ORIGIN; j < ARR_WIDTH - 1; ++j) {
-      white_laser_map[ARR_WIDTH * i + j] = 0;
-      black_laser_map[ARR_WIDTH * i + j] = 0;
+
+  ev_score_t tot = score[WHITE] - score[BLACK];
+  if (!all_known) {
+    score_t lo_score = eval_finish(p, tot + lo);
+    score_t hi_score = eval_finish(p, tot + hi);
+    if (color_to_move_of(p) == BLACK) {
+      score_t t = lo_score;
+      lo_score = hi_score;
+      hi_score = t;
+    }
+    if (hi_score <= alpha) {
+      tbassert(eval_of_copy(p) <= hi_score, "bound: %d\n", hi_score);
+      return hi_score;
+    }
+    if (lo_score >= beta) {
+      tbassert(eval_of_copy(p) >= lo_score, "bound: %d\n", lo_score);
+      return lo_score;
+    }
+
+    for (color_t c = WHITE; c <= BLACK; c++) {
+      if (!laser_known(p, c)) {
+        eval_laser_terms(p, c, score);
+      }
     }
+    tot = score[WHITE] - score[BLACK];
   }
+  return eval_finish(p, tot);
+}
 
-  // Compute some values for heuristics.
-  float squares_attackable[2] = { 0, 0 };
-  int num_pinned_pawns[2] = { 0, 0 };
-  mark_laser_path_with_heuristics(p, WHITE, white_laser_map, 1,
-                                  &(squares_attackable[WHITE]),
-                                  &(num_pinned_pawns[BLACK]));
-  mark_laser_path_with_heuristics(p, BLACK, black_laser_map, 1,
-                                  &(squares_attackable[BLACK]),
-                                  &(num_pinned_pawns[WHITE]));
+// -----------------------------------------------------------------------------
+// Child scores for move ordering
+// -----------------------------------------------------------------------------
 
-  // H_SQUARES_ATTACKABLE heuristic
-  score[WHITE] += HATTACK * (int) squares_attackable[WHITE];
-  score[BLACK] += HATTACK * (int) squares_attackable[BLACK];
-  if (verbose) {
-    printf("HATTACK bonus %d for White\n",
-           HATTACK * (int) squares_attackable[WHITE]);
-    printf("HATTACK bonus %d for Black\n",
-           HATTACK * (int) squares_attackable[BLACK]);
+// Sets scores[i] to a cheap static score of the position after move_list[i]
+// in p, from the point of view of the side to move in p, in ev_score_t units.
+// The score has the terms of eval() that follow from where the pieces go:
+// MATERIAL, PCENTRAL, PBETWEEN, KFACE, KAGGRESSIVE, and MOBILITY against the
+// lasers of p.  Most moves leave the lasers as they are, so they are traced
+// once for all the children; HATTACK, PAWNPIN and the pieces that the move
+// zaps are left out.
+void eval_children(position_t * p, sortable_move_t * move_list,
+                   int num_of_moves, ev_score_t * scores) {
+  color_t c = color_to_move_of(p);
+  bitboard_t path[2] = { laser_path_bb(p, WHITE), laser_path_bb(p, BLACK) };
+
+  for (int i = 0; i < num_of_moves; i++) {
+    move_t mv = get_move(move_list[i]);
+    square_t fs = from_square(mv);
+    square_t ts = to_square(mv);
+    piece_t from_piece = p->board[fs];
+    piece_t to_piece = p->board[ts];
+
+    int32_t pawn[2] = { p->ev.pawn[WHITE], p->ev.pawn[BLACK] };
+    bitboard_t pawns[2] = { pawns_bb_of(p, WHITE), pawns_bb_of(p, BLACK) };
+    square_t kloc[2] = { p->kloc[WHITE], p->kloc[BLACK] };
+    int kori[2] = { ori_of(p->board[kloc[WHITE]]),
+                    ori_of(p->board[kloc[BLACK]]) };
+
+    if (fs == ts) {  // rotation
+      if (ptype_of(from_piece) == KING) {
+        kori[c] = ORI_MASK & (kori[c] + rot_of(mv));
+      }
+    } else {  // the pieces on fs and ts swap squares
+      bitboard_t both = square_bb(fs) | square_bb(ts);
+      if (ptype_of(from_piece) == PAWN) {
+        pawn[color_of(from_piece)] += pawn_ev_table[ts] - pawn_ev_table[fs];
+        pawns[color_of(from_piece)] ^= both;
+      } else {
+        kloc[color_of(from_piece)] = ts;
+      }
+      if (ptype_of(to_piece) == PAWN) {
+        pawn[color_of(to_piece)] += pawn_ev_table[fs] - pawn_ev_table[ts];
+        pawns[color_of(to_piece)] ^= both;
+      } else if (ptype_of(to_piece) == KING) {
+        kloc[color_of(to_piece)] = fs;
+      }
+    }
+
+    bitboard_t rect = king_rect_bb(kloc[WHITE], kloc[BLACK]);
+    ev_score_t score[2];
+    for (color_t x = WHITE; x <= BLACK; x++) {
+      square_t k = kloc[x];
+      square_t o = kloc[opp_color(x)];
+      score[x] = pawn[x] +
+                 king_table[bb_index(fil_of(k), rnk_of(k))]
+                           [bb_index(fil_of(o), rnk_of(o))][kori[x]] +
+                 PBETWEEN * bb_popcount(pawns[x] & rect) +
+                 MOBILITY * bb_popcount(king_area_bb(k) & ~path[opp_color(x)]);
+    }
+    scores[i] = score[c] - score[opp_color(c)];
   }
+}
 
-  // MOBILITY heuristic
-  score[WHITE] += MOBILITY * get_king_mobility(p, black_laser_map, WHITE);
-  score[BLACK] += MOBILITY * get_king_mobility(p, white_laser_map, BLACK);
+// -----------------------------------------------------------------------------
+// Features for tuning
+// -----------------------------------------------------------------------------
 
-  // PAWNPIN heuristic --- is a pawn immobilized by the enemy laser.
-  score[WHITE] += PAWNPIN * (p->ploc[WHITE].pawns_count - num_pinned_pawns[WHITE]);
-  score[BLACK] += PAWNPIN * (p->ploc[BLACK].pawns_count - num_pinned_pawns[BLACK]);
-  
-  // score from WHITE point of view
-  ev_score_t tot = score[WHITE] - score[BLACK];
+const char *eval_feature_name[NUM_EVAL_FEATURES] = {
+  "hattack", "mobility", "kaggressive", "kface", "pawnpin", "pbetween",
+  "pcentral"
+};
 
-  if (RANDOMIZE) {
-    ev_score_t z = rand_r(&seed) % (RANDOMIZE * 2 + 1);
-    tot = tot + z - RANDOMIZE;
+int *eval_feature_weight[NUM_EVAL_FEATURES] = {
+  &HATTACK, &MOBILITY, &KAGGRESSIVE, &KFACE, &PAWNPIN, &PBETWEEN, &PCENTRAL
+};
+
+// Fills in x[i] with what the term weighted by eval_feature_weight[i] adds to
+// the score of White minus the score of Black in p, for a weight of 1, and
+// returns the terms that have no weight to tune: the MATERIAL heuristic.
+// eval() of p from WHITE point of view, before RANDOMIZE, is the return
+// value plus x[i] times each weight, except that eval() rounds PCENTRAL,
+// KFACE and KAGGRESSIVE towards zero for each Pawn and King.
+ev_score_t eval_features(position_t * p, double x[NUM_EVAL_FEATURES]) {
+  for (int i = 0; i < NUM_EVAL_FEATURES; i++) {
+    x[i] = 0;
   }
 
-  if (color_to_move_of(p) == BLACK) {
-    tot = -tot;
+  for (color_t c = WHITE; c <= BLACK; c++) {
+    color_t o = opp_color(c);
+    int sign = (c == WHITE) ? 1 : -1;
+    fil_t f = fil_of(p->kloc[c]);
+    rnk_t r = rnk_of(p->kloc[c]);
+    fil_t of = fil_of(p->kloc[o]);
+    rnk_t _or = rnk_of(p->kloc[o]);
+    int ori = ori_of(p->board[p->kloc[c]]);
+
+    x[EVF_HATTACK] += sign * laser_attackable(p, c);
+    x[EVF_MOBILITY] += sign * get_king_mobility(p, laser_path_bb(p, o), c);
+    x[EVF_KAGGRESSIVE] +=
+        sign * (double) kaggressive_bonus(f, r, of, _or) / BOARD_SIZE;
+    x[EVF_KFACE] += sign * (double) kface_bonus(f, r, ori, of, _or) /
+                    (abs(_or - r) + abs(of - f));
+    x[EVF_PAWNPIN] += sign * (pawns_count_of(p, c) - laser_pawns_hit(p, o));
+    x[EVF_PBETWEEN] += sign * pawns_between(p, c);
+    for (bitboard_t pawns = pawns_bb_of(p, c); pawns != 0;
+         pawns &= pawns - 1) {
+      square_t sq = bb_square(bb_ctz(pawns));
+      x[EVF_PCENTRAL] += sign * pcentral_bonus(fil_of(sq), rnk_of(sq));
+    }
   }
 
-  return tot / EV_SCORE_RATIO;
+  return PAWN_EV_VALUE * (pawns_count_of(p, WHITE) - pawns_count_of(p, BLACK));
 }
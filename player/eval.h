@@ -4,6 +4,7 @@
 #define EVAL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "./move_gen.h"
 #include "./search.h"
@@ -13,16 +14,45 @@
 // ev_score_t values
 #define PAWN_EV_VALUE (PAWN_VALUE*EV_SCORE_RATIO)
 
-inline void mark_laser_path(position_t *p, color_t c, char *laser_map,
-				   char mark_mask);
+typedef int32_t ev_score_t;     // Static evaluator uses "hi res" values
 
-void mark_laser_path_with_heuristics(
-    position_t *p, color_t c, char *laser_map, char mark_mask,
-    float* squares_attackable,
-    int* num_enemy_pinned_pawns);
-
-int generate_pinned_pawn_list(position_t *p, color_t c, square_t* pinned_pawn_list);
+// MATERIAL plus PCENTRAL for a Pawn on each square, filled in by
+// init_eval_tables().
+extern ev_score_t pawn_ev_table[ARR_SIZE];
 
+void init_eval_tables();
+void init_ev_terms(position_t *p);
+bool ev_terms_are_current(position_t *p);
 score_t eval(position_t *p, bool verbose);
+score_t eval_bounded(position_t *p, score_t alpha, score_t beta);
+void eval_children(position_t *p, sortable_move_t *move_list,
+                   int num_of_moves, ev_score_t *scores);
+void eval_stats_reset();
+void eval_stats_report();
+
+// Terms of eval() with a weight that the tuner fits, in the order of the
+// options that set the weights.
+typedef enum {
+  EVF_HATTACK,
+  EVF_MOBILITY,
+  EVF_KAGGRESSIVE,
+  EVF_KFACE,
+  EVF_PAWNPIN,
+  EVF_PBETWEEN,
+  EVF_PCENTRAL,
+  NUM_EVAL_FEATURES
+} eval_feature_t;
+
+extern const char *eval_feature_name[NUM_EVAL_FEATURES];  // option names
+extern int *eval_feature_weight[NUM_EVAL_FEATURES];
+
+ev_score_t eval_features(position_t *p, double x[NUM_EVAL_FEATURES]);
+
+// Adds (sign 1) or removes (sign -1) a Pawn of color c on sq to or from the
+// running eval sums of p.
+static inline void update_pawn_terms(position_t *p, color_t c, square_t sq,
+                                     int sign) {
+  p->ev.pawn[c] += sign * pawn_ev_table[sq];
+}
 
 #endif  // EVAL_H
@@ -5,9 +5,20 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "./eval.h"
 #include "./move_gen.h"
 #include "./tbassert.h"
 
+// Starting position.  The 10x10 one is the 8x8 one centered on the larger
+// board, with the Kings moved out to the corners.
+#if BOARD_WIDTH == 10
+#define START_FEN \
+  "ss9/5nw4/4nw5/3nw1nw4/2nw3SE1SE1/1nw1nw3SE2/4SE1SE3/5SE4/4SE5/9NN W"
+#else
+#define START_FEN \
+  "ss3nw3/3nw4/2nw1nw3/1nw3SE1SE/nw1nw3SE1/3SE1SE2/4SE3/3SE3NN W"
+#endif
+
 static void fen_error(char *fen, int c_count, char *msg) {
   fprintf(stderr, "\nError in FEN string:\n");
   fprintf(stderr, "   %s\n  ", fen);  // Indent 3 spaces
@@ -70,7 +81,7 @@ static int parse_fen_board(position_t *p, char *fen) {
             fen_error(fen, c_count, "Too many squares in rank.\n");
             return 0;
           }
-          set_ptype(&p->board[square_table[f][r]], EMPTY);
+          set_ptype(&p->board[square_at(f, r)], EMPTY);
           c--;
         }
         break;
@@ -96,10 +107,10 @@ static int parse_fen_board(position_t *p, char *fen) {
           fen_error(fen, c_count+1, "Syntax error");
           return 0;
         }
-        set_ptype(&p->board[square_table[f][r]], typ);
-        set_color(&p->board[square_table[f][r]], WHITE);
-        set_ori(&p->board[square_table[f][r]], ori);
-        set_rank_and_file(p, square_of(f, r));
+        set_ptype(&p->board[square_at(f, r)], typ);
+        set_color(&p->board[square_at(f, r)], WHITE);
+        set_ori(&p->board[square_at(f, r)], ori);
+        toggle_piece_bb(p, square_of(f, r), p->board[square_of(f, r)]);
 
         break;
 
@@ -123,10 +134,10 @@ static int parse_fen_board(position_t *p, char *fen) {
           fen_error(fen, c_count+1, "Syntax error");
           return 0;
         }
-        set_ptype(&p->board[square_table[f][r]], typ);
-        set_color(&p->board[square_table[f][r]], BLACK);
-        set_ori(&p->board[square_table[f][r]], ori);
-        set_rank_and_file(p, square_of(f, r));
+        set_ptype(&p->board[square_at(f, r)], typ);
+        set_color(&p->board[square_at(f, r)], BLACK);
+        set_ori(&p->board[square_at(f, r)], ori);
+        toggle_piece_bb(p, square_of(f, r), p->board[square_of(f, r)]);
         break;
 
       case 'S':
@@ -149,10 +160,10 @@ static int parse_fen_board(position_t *p, char *fen) {
           fen_error(fen, c_count+1, "Syntax error");
           return 0;
         }
-        set_ptype(&p->board[square_table[f][r]], typ);
-        set_color(&p->board[square_table[f][r]], WHITE);
-        set_ori(&p->board[square_table[f][r]], ori);
-        set_rank_and_file(p, square_of(f, r));
+        set_ptype(&p->board[square_at(f, r)], typ);
+        set_color(&p->board[square_at(f, r)], WHITE);
+        set_ori(&p->board[square_at(f, r)], ori);
+        toggle_piece_bb(p, square_of(f, r), p->board[square_of(f, r)]);
         break;
 
       case 's':
@@ -175,10 +186,10 @@ static int parse_fen_board(position_t *p, char *fen) {
           fen_error(fen, c_count+1, "Syntax error");
           return 0;
         }
-        set_ptype(&p->board[square_table[f][r]], typ);
-        set_color(&p->board[square_table[f][r]], BLACK);
-        set_ori(&p->board[square_table[f][r]], ori);
-        set_rank_and_file(p, square_of(f, r));
+        set_ptype(&p->board[square_at(f, r)], typ);
+        set_color(&p->board[square_at(f, r)], BLACK);
+        set_ori(&p->board[square_at(f, r)], ori);
+        toggle_piece_bb(p, square_of(f, r), p->board[square_of(f, r)]);
         break;
 
       case 'E':
@@ -189,10 +200,10 @@ static int parse_fen_board(position_t *p, char *fen) {
         next_c = fen[c_count++];
 
         if (next_c == 'E') {  // White King facing East
-          set_ptype(&p->board[square_table[f][r]], KING);
-          set_color(&p->board[square_table[f][r]], WHITE);
-          set_ori(&p->board[square_table[f][r]], EE);
-          set_rank_and_file(p, square_of(f, r));
+          set_ptype(&p->board[square_at(f, r)], KING);
+          set_color(&p->board[square_at(f, r)], WHITE);
+          set_ori(&p->board[square_at(f, r)], EE);
+          toggle_piece_bb(p, square_of(f, r), p->board[square_of(f, r)]);
         } else {
           fen_error(fen, c_count+1, "Syntax error");
           return 0;
@@ -207,10 +218,10 @@ static int parse_fen_board(position_t *p, char *fen) {
         next_c = fen[c_count++];
 
         if (next_c == 'W') {  // White King facing West
-          set_ptype(&p->board[square_table[f][r]], KING);
-          set_color(&p->board[square_table[f][r]], WHITE);
-          set_ori(&p->board[square_table[f][r]], WW);
-          set_rank_and_file(p, square_of(f, r));
+          set_ptype(&p->board[square_at(f, r)], KING);
+          set_color(&p->board[square_at(f, r)], WHITE);
+          set_ori(&p->board[square_at(f, r)], WW);
+          toggle_piece_bb(p, square_of(f, r), p->board[square_of(f, r)]);
         } else {
           fen_error(fen, c_count+1, "Syntax error");
           return 0;
@@ -225,10 +236,10 @@ static int parse_fen_board(position_t *p, char *fen) {
         next_c = fen[c_count++];
 
         if (next_c == 'e') {  // Black King facing East
-          set_ptype(&p->board[square_table[f][r]], KING);
-          set_color(&p->board[square_table[f][r]], BLACK);
-          set_ori(&p->board[square_table[f][r]], EE);
-          set_rank_and_file(p, square_of(f, r));
+          set_ptype(&p->board[square_at(f, r)], KING);
+          set_color(&p->board[square_at(f, r)], BLACK);
+          set_ori(&p->board[square_at(f, r)], EE);
+          toggle_piece_bb(p, square_of(f, r), p->board[square_of(f, r)]);
         } else {
           fen_error(fen, c_count+1, "Syntax error");
           return 0;
@@ -243,10 +254,10 @@ static int parse_fen_board(position_t *p, char *fen) {
         next_c = fen[c_count++];
 
         if (next_c == 'w') {  // Black King facing West
-          set_ptype(&p->board[square_table[f][r]], KING);
-          set_color(&p->board[square_table[f][r]], BLACK);
-          set_ori(&p->board[square_table[f][r]], WW);
-          set_rank_and_file(p, square_of(f, r));
+          set_ptype(&p->board[square_at(f, r)], KING);
+          set_color(&p->board[square_at(f, r)], BLACK);
+          set_ori(&p->board[square_at(f, r)], WW);
+          toggle_piece_bb(p, square_of(f, r), p->board[square_of(f, r)]);
         } else {
           fen_error(fen, c_count+1, "Syntax error");
           return 0;
@@ -314,70 +325,51 @@ static int get_sq_from_str(char *fen, int *c_count, int *sq) {
       return 1;
     }
 
-    *sq = square_table[c - 'a'][next_c - '0'];
+    *sq = square_at(c - 'a', next_c - '0');
     return 0;
   }
   return 0;
 }
 
-// Translate a fen string into a board position struct
-//
-int fen_to_pos(position_t *p, char *fen) {
-  static  position_t dmy1, dmy2;
-
-  // these sentinels simplify checking previous
-  // states without stepping past null pointers.
-  dmy1.key = 0;
-  dmy1.victims.zapped_count = 1;
-  dmy1.victims.zapped[0] = 1;
-  dmy1.history = NULL;
-
-  dmy2.key = 0;
-  dmy2.victims.zapped_count = 1;
-  dmy2.victims.zapped[0] = 1;
-  dmy2.history = &dmy1;
-
-
+// these sentinels simplify checking previous
+// states without stepping past null pointers.
+static position_t dmy1 = {
+  .key = 0, .victims = { .zapped_count = 1, .zapped = { 1 } }, .history = NULL
+};
+static position_t dmy2 = {
+  .key = 0, .victims = { .zapped_count = 1, .zapped = { 1 } }, .history = &dmy1
+};
+
+// Sets p up as an empty board with no history, ready for pieces to be
+// placed with toggle_piece_bb().
+static void clear_pos(position_t *p) {
   p->key = 0;                   // hash key
+  p->rep_filter = 0;            // no earlier positions to repeat
   p->victims.zapped_count = 0;  // piece destroyed by shooter
   p->history = &dmy2;           // history
+  p->last_move = 0;
 
-  // Pawn counts
-  p->ploc[WHITE].pawns_count = 0;
-  p->ploc[BLACK].pawns_count = 0;
-
-  // initalize the ranks and files
-  for (int i=0; i < 8; i++) {
-    p->ranks[i] = 0; 
-    p->files[i] = 0; 
-  }
-
-  if (fen[0] == '\0') {  // Empty FEN => use starting position
-    fen = "ss3nw3/3nw4/2nw1nw3/1nw3SE1SE/nw1nw3SE1/3SE1SE2/4SE3/3SE3NN W";
-  }
-
-  int c_count = 0;  // Invariant: fen[c_count] is next char to be read
+  // initalize the bitboards
+  p->occupied = 0;
+  p->occupied_t = 0;
+  p->color_bb[WHITE] = 0;
+  p->color_bb[BLACK] = 0;
+  p->pawn_bb = 0;
+  p->laser.valid = 0;           // no laser traced yet
 
   for (int i = 0; i < ARR_SIZE; ++i) {
     p->board[i] = 0;
     set_ptype(&p->board[i], INVALID);  // squares are invalid until filled
   }
+}
 
-  c_count = parse_fen_board(p, fen);
-  if (!c_count) {
-    return 1;  // parse error of board
-  }
-
-  // King and Pawn check
-
+// King check: finds the Kings of p and sets kloc.  Returns NULL if there is
+// one King of each color, and what is wrong otherwise.
+static char *find_kings(position_t *p) {
   int Kings[2] = {0, 0};
   for (fil_t f = 0; f < BOARD_WIDTH; ++f) {
     for (rnk_t r = 0; r < BOARD_WIDTH; ++r) {
-      // initialize pawns_map
-      p->ploc[0].pawns_map[f][r] = MAX_PAWNS;
-      p->ploc[1].pawns_map[f][r] = MAX_PAWNS;
-
-      square_t sq = square_table[f][r];
+      square_t sq = square_at(f, r);
       piece_t x = p->board[sq];
       ptype_t typ = ptype_of(x);
       if (typ == KING) {
@@ -385,31 +377,46 @@ int fen_to_pos(position_t *p, char *fen) {
         Kings[col]++;
         p->kloc[col] = sq;
         // printf("f: %d, r: %d, sq: %d\n", f, r, sq);
-      } else if (typ == PAWN) {
-        // Caution: assumes that the number of pawns per color never exceeds 8!
-        color_t col = color_of(x);
-        pawns_t* pawns = &(p->ploc[col]);
-        pawns->squares[pawns->pawns_count] = sq;
-        pawns->pawns_map[f][r] = pawns->pawns_count;
-        ++pawns->pawns_count;
-      } 
+      }
     }
   }
 
   if (Kings[WHITE] == 0) {
-    fen_error(fen, c_count, "No White Kings");
-    return 1;
+    return "No White Kings";
   } else if (Kings[WHITE] > 1) {
-    fen_error(fen, c_count, "Too many White Kings");
-    return 1;
+    return "Too many White Kings";
   } else if (Kings[BLACK] == 0) {
-    fen_error(fen, c_count, "No Black Kings");
-    return 1;
+    return "No Black Kings";
   } else if (Kings[BLACK] > 1) {
-    fen_error(fen, c_count, "Too many Black Kings");
+    return "Too many Black Kings";
+  }
+  return NULL;
+}
+
+// Translate a fen string into a board position struct
+//
+int fen_to_pos(position_t *p, char *fen) {
+  clear_pos(p);
+
+  if (fen[0] == '\0') {  // Empty FEN => use starting position
+    fen = START_FEN;
+  }
+
+  int c_count = 0;  // Invariant: fen[c_count] is next char to be read
+
+  c_count = parse_fen_board(p, fen);
+  if (!c_count) {
+    return 1;  // parse error of board
+  }
+
+  char *king_error = find_kings(p);
+  if (king_error != NULL) {
+    fen_error(fen, c_count, king_error);
     return 1;
   }
 
+  init_ev_terms(p);
+
   char c;
   bool done = false;
   // Look for color to move and set ply accordingly
@@ -519,7 +526,7 @@ int pos_to_fen(position_t *p, char *fen) {
   for (rnk_t r = BOARD_WIDTH - 1; r >=0 ; --r) {
     int empty_in_a_row = 0;
     for (fil_t f = 0; f < BOARD_WIDTH; ++f) {
-      square_t sq = square_table[f][r];
+      square_t sq = square_at(f, r);
 
       if (ptype_of(p->board[sq]) == INVALID) {     // invalid square
         tbassert(false, "Bad news, yo.\n");        // This is bad!
@@ -562,3 +569,33 @@ int pos_to_fen(position_t *p, char *fen) {
 
   return pos;
 }
+
+// Packs the board and the color to move of p.
+void pos_to_packed(position_t *p, packed_pos_t *pp) {
+  for (int i = 0; i < BOARD_SIZE; i++) {
+    pp->board[i] = p->board[bb_square(i)];
+  }
+  pp->ply = p->ply & 1;
+}
+
+// Sets up p from a packed position, like fen_to_pos() does from a FEN
+// string without a last move.  Returns 1 if the Kings are not right.
+int packed_to_pos(position_t *p, const packed_pos_t *pp) {
+  clear_pos(p);
+
+  for (int i = 0; i < BOARD_SIZE; i++) {
+    square_t sq = bb_square(i);
+    p->board[sq] = pp->board[i];
+    if (ptype_of(p->board[sq]) != EMPTY) {
+      toggle_piece_bb(p, sq, p->board[sq]);
+    }
+  }
+
+  if (find_kings(p) != NULL) {
+    return 1;
+  }
+  init_ev_terms(p);
+  p->ply = pp->ply & 1;
+  p->key = compute_zob_key(p);
+  return 0;
+}
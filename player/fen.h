@@ -3,7 +3,9 @@
 #ifndef FEN_H
 #define FEN_H
 
-struct position;
+#include <stdint.h>
+
+#include "./move_gen.h"
 
 // Assuming BOARD_WIDTH is at most 99, MAX_FEN_CHARS is
 //   BOARD_WIDTH * BOARD_WIDTH * 2  (for a piece in every square)
@@ -11,7 +13,16 @@ struct position;
 //   + 2  (for final space and player turn)
 #define MAX_FEN_CHARS 128
 
-int fen_to_pos(struct position *p, char *fen);
-int pos_to_fen(struct position *p, char *fen);
+// A position as stored in files: the piece on each square, in bitboard index
+// order, and whose move it is.  The history and the last move are not kept.
+typedef struct packed_pos {
+  piece_t board[BOARD_SIZE];
+  uint8_t ply;                  // 0 if White is to move, 1 if Black
+} packed_pos_t;
+
+int fen_to_pos(position_t *p, char *fen);
+int pos_to_fen(position_t *p, char *fen);
+void pos_to_packed(position_t *p, packed_pos_t *pp);
+int packed_to_pos(position_t *p, const packed_pos_t *pp);
 
 #endif  // FEN_H
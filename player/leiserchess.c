@@ -4,6 +4,7 @@
 #endif
 
 #include <ctype.h>
+#include <math.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -24,8 +25,10 @@
 #include "./fen.h"
 #include "./move_gen.h"
 #include "./search.h"
+#include "./selfplay.h"
 #include "./tbassert.h"
 #include "./tt.h"
+#include "./tune.h"
 #include "./util.h"
 
 char  VERSION[] = "1038";
@@ -70,9 +73,12 @@ extern int LMR_R1;
 extern int LMR_R2;
 extern int HMB;
 extern int USE_NMM;
+extern int LAZY_EVAL;
+extern int EVAL_ORDER;
 extern int FUT_DEPTH;
 extern int TRACE_MOVES;
 extern int DETECT_DRAWS;
+extern int MULTIPV;
 
 // defined in eval.c
 extern int RANDOMIZE;
@@ -86,6 +92,7 @@ extern int PAWNPIN;
 
 // defined in move_gen.c
 extern int USE_KO;
+extern int PERFT_HASH;
 
 // defined in tt.c
 extern int USE_TT;
@@ -117,14 +124,18 @@ static int_options iopts[] = {
   { "pbetween",           &PBETWEEN,   0.2 * PAWN_EV_VALUE,   -PAWN_EV_VALUE, PAWN_EV_VALUE },
   { "pcentral",           &PCENTRAL,   0.05 * PAWN_EV_VALUE,  -PAWN_EV_VALUE, PAWN_EV_VALUE },
   { "hash",                   &HASH,   16,                    1,              MAX_HASH   },
+  { "perft_hash",       &PERFT_HASH,   64,                    0,              MAX_HASH   },
   { "draw",                   &DRAW,   -0.07 * PAWN_VALUE,    -PAWN_VALUE,    PAWN_VALUE    },
   { "randomize",         &RANDOMIZE,   0,                     0,              PAWN_EV_VALUE },
   { "lmr_r1",               &LMR_R1,   5,                     1,              MAX_NUM_MOVES },
   { "lmr_r2",               &LMR_R2,   20,                    1,              MAX_NUM_MOVES },
   { "hmb",                     &HMB,   0.03 * PAWN_VALUE,     0,              PAWN_VALUE    },
   { "fut_depth",         &FUT_DEPTH,   3,                     0,              5             },
+  { "multipv",             &MULTIPV,   1,                     1,              MAX_NUM_MOVES },
   // debug options
   { "use_nmm",             &USE_NMM,   1,                     0,              1             },
+  { "lazy_eval",         &LAZY_EVAL,   0,                     0,              1             },
+  { "eval_order",       &EVAL_ORDER,   0,                     0,              1             },
   { "detect_draws",   &DETECT_DRAWS,   1,                     0,              1             },
   { "use_tt",               &USE_TT,   1,                     0,              1             },
   { "use_ko",               &USE_KO,   1,                     0,              1             },
@@ -152,25 +163,7 @@ void lower_case(char *s) {
 // makes the move described by 'mvstring'
 victims_t make_from_string(position_t *old, position_t *p,
                            const char *mvstring) {
-  sortable_move_t lst[MAX_NUM_MOVES];
-  move_t mv = 0;
-  // make copy so that mvstring can be a constant
-  char string[MAX_CHARS_IN_MOVE];
-  int move_count = generate_all(old, lst, true);
-
-  snprintf(string, MAX_CHARS_IN_MOVE, "%s", mvstring);
-  lower_case(string);
-
-  for (int i = 0; i < move_count; i++) {
-    char buf[MAX_CHARS_IN_MOVE];
-    move_to_str(get_move(lst[i]), buf, MAX_CHARS_IN_MOVE);
-    lower_case(buf);
-
-    if (strcmp(buf, string) == 0) {
-      mv = get_move(lst[i]);
-      break;
-    }
-  }
+  move_t mv = move_from_str(old, mvstring);
   return (mv == 0) ? ILLEGAL() : make_move(old, p, mv);
 }
 
@@ -192,6 +185,7 @@ static char theMove[MAX_CHARS_IN_MOVE];
 
 static pthread_mutex_t entry_mutex;
 static uint64_t node_count_serial;
+static root_moves_t root_moves;
 
 typedef struct {
   position_t *p;
@@ -239,7 +233,7 @@ void *entry_point(void *arg) {
       reset_abort();
 
     searchRoot(p, -INF, INF, d, 0, &optimal_move, &node_count_serial,
-                OUT);
+               &root_moves, OUT);
 
     et = elapsed_time();
     bestMoveSoFar = optimal_move;
@@ -309,7 +303,12 @@ void UciBeginSearch(position_t *p, int depth, double tme) {
 
 // print help messages in uci
 void help()  {
-  printf("eval      - Evaluate current position.\n");
+  printf("eval      - Evaluate current position and print each term of the\n");
+  printf("            evaluation.  Sample usage: \n");
+  printf("                eval j0j1: evaluate the position after move j0j1\n");
+  printf("evalstats - Report how often each eval term was computed, its cost in\n");
+  printf("            cycles and the values it took, in a build made with\n");
+  printf("            EVALSTATS=1.  \"evalstats reset\" clears the counts.\n");
   printf("display   - Display current board state.\n");
   printf("generate  - Generate all possible moves.\n");
   printf("go        - Search from current state.  Possible arguments are:\n");
@@ -329,7 +328,9 @@ void help()  {
   printf("perft     - Output the number of possible moves upto a given depth.\n");
   printf("            Used to verify move the generator.\n");
   printf("            Sample usage: \n");
-  printf("                depth 3: generate all possible moves for depth 1--3\n");
+  printf("                perft 3: generate all possible moves for depth 1--3\n");
+  printf("                perft divide 3: count the moves for depth 3 below each\n");
+  printf("                                first move\n");
   printf("position  - Set up the board using the fenstring given.  Possible arguments are:\n");
   printf("            startpos:     set up the board with default starting position.\n");
   printf("            endgame:      set up the board with endgame configuration.\n");
@@ -338,11 +339,31 @@ void help()  {
   printf("            Sample usage: \n");
   printf("                position endgame: set up the board so that only kings remain\n");
   printf("quit      - Quit this program\n");
+  printf("selfplay  - Play games of the engine against itself, all at once, and write\n");
+  printf("            the positions searched with their scores and the game results\n");
+  printf("            to a file for tune.  Possible arguments are:\n");
+  printf("            <file>:            the file to write\n");
+  printf("            games <n>:         number of games (100)\n");
+  printf("            depth <depth>:     search depth of each move (4)\n");
+  printf("            nodes <n>:         deepen each search until it visits <n> nodes\n");
+  printf("            book <file>:       opening lines to start the games from, or\n");
+  printf("                               \"none\" (../tests/book.dta)\n");
+  printf("            random <n>:        random moves after the opening line (0)\n");
+  printf("            plies <n>:         game length at which a game is drawn (400)\n");
+  printf("            Sample usage: \n");
+  printf("                selfplay games.bin games 1000 depth 5 random 2\n");
   printf("setoption - Set configuration options used in the engine, the format is: \n");
   printf("            setoption name <name> value <val>.\n");
   printf("            Use the comment \"uci\" to see possible options and their current values\n");
   printf("            Sample usage: \n");
   printf("                setoption name fut_depth value 4: set fut_depth to 4\n");
+  printf("tune      - Fit the eval weights to a corpus of positions with game results,\n");
+  printf("            and print the options that set them.  Possible arguments are:\n");
+  printf("            <file>:            the corpus, as written by selfplay\n");
+  printf("            iterations <n>:    number of passes over the corpus (1000)\n");
+  printf("            rate <r>:          largest step of a weight per pass (20)\n");
+  printf("            Sample usage: \n");
+  printf("                tune games.bin iterations 500\n");
   printf("uci       - Display UCI version and options\n");
   printf("\n");
 }
@@ -483,7 +504,10 @@ int main(int argc, char *argv[]) {
   }
 
   init_options();
+  init_eval_tables();
   init_zob();
+  init_move_tables();
+  init_laser_tables();
 
   char **tok = (char **) malloc(sizeof(char *) * MAX_CHARS_IN_TOKEN * MAX_PLY_IN_GAME);
   int   ix = 0;  // index of which position we are operating on
@@ -669,6 +693,13 @@ int main(int argc, char *argv[]) {
               printf("info setting %s to %d\n", iopts[j].name, v);
               *(iopts[j].var) = v;
 
+              if (strcmp(name+1, "pcentral") == 0 ||
+                  strcmp(name+1, "kface") == 0 ||
+                  strcmp(name+1, "kaggressive") == 0) {
+                init_eval_tables();
+              }
+              // the running eval sums of the position include the weights
+              init_ev_terms(&gme[ix]);
               if (strcmp(name+1, "hash") == 0) {
                 tt_resize_hashtable(HASH);
                 printf("info string Hash table set to %d records of "
@@ -726,6 +757,84 @@ int main(int argc, char *argv[]) {
         continue;
       }
 
+      if (strcmp(tok[0], "evalstats") == 0) {
+        if (token_count > 1 && strcmp(tok[1], "reset") == 0) {
+          eval_stats_reset();
+        } else {
+          eval_stats_report();
+        }
+        continue;
+      }
+
+      if (strcmp(tok[0], "selfplay") == 0) {
+        if (token_count < 2) {
+          fprintf(OUT, "info string selfplay needs a file to write\n");
+          continue;
+        }
+        selfplay_args_t args = { 100, 0, 0, "../tests/book.dta", 0, 400 };
+        for (int n = 2; n + 1 < token_count; n += 2) {
+          if (strcmp(tok[n], "games") == 0) {
+            args.games = strtol(tok[n + 1], (char **)NULL, 10);
+          } else if (strcmp(tok[n], "depth") == 0) {
+            args.depth = strtol(tok[n + 1], (char **)NULL, 10);
+          } else if (strcmp(tok[n], "nodes") == 0) {
+            args.nodes = strtoull(tok[n + 1], (char **)NULL, 10);
+          } else if (strcmp(tok[n], "book") == 0) {
+            args.book = (strcmp(tok[n + 1], "none") == 0) ? NULL : tok[n + 1];
+          } else if (strcmp(tok[n], "random") == 0) {
+            args.random_plies = strtol(tok[n + 1], (char **)NULL, 10);
+          } else if (strcmp(tok[n], "plies") == 0) {
+            args.max_plies = strtol(tok[n + 1], (char **)NULL, 10);
+          }
+        }
+        if (args.depth == 0) {
+          args.depth = (args.nodes > 0) ? MAX_PLY_IN_SEARCH / 2 : 4;
+        }
+        if (args.max_plies >= MAX_PLY_IN_GAME) {
+          args.max_plies = MAX_PLY_IN_GAME - 1;
+        }
+        selfplay(tok[1], &args);
+        continue;
+      }
+
+      if (strcmp(tok[0], "tune") == 0) {
+        if (token_count < 2) {
+          fprintf(OUT, "info string tune needs a corpus file\n");
+          continue;
+        }
+        int iterations = 1000;
+        double rate = 20;
+        for (int n = 2; n + 1 < token_count; n += 2) {
+          if (strcmp(tok[n], "iterations") == 0) {
+            iterations = strtol(tok[n + 1], (char **)NULL, 10);
+          } else if (strcmp(tok[n], "rate") == 0) {
+            rate = strtod(tok[n + 1], (char **)NULL);
+          }
+        }
+
+        // start from the current weights, within the bounds of their options
+        int lo[NUM_EVAL_FEATURES];
+        int hi[NUM_EVAL_FEATURES];
+        double w[NUM_EVAL_FEATURES];
+        for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+          for (int i = 0; iopts[i].var != NULL; i++) {
+            if (iopts[i].var == eval_feature_weight[j]) {
+              lo[j] = iopts[i].min;
+              hi[j] = iopts[i].max;
+            }
+          }
+          w[j] = *eval_feature_weight[j];
+        }
+
+        if (tune_eval_weights(tok[1], iterations, rate, lo, hi, w) == 0) {
+          for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+            fprintf(OUT, "setoption name %s value %d\n", eval_feature_name[j],
+                    (int) lround(w[j]));
+          }
+        }
+        continue;
+      }
+
       if (strcmp(tok[0], "go") == 0) {
         #ifdef PROFILE
         ProfilerStart("profile.data");
@@ -776,10 +885,16 @@ int main(int argc, char *argv[]) {
 
 
         int depth = 4;
-        if (token_count >= 2) {  // Takes a depth argument to test deeper
-          depth = strtol(tok[1], (char **)NULL, 10);
+        int arg = 1;
+        bool divide = false;
+        if (token_count > arg && strcmp(tok[arg], "divide") == 0) {
+          divide = true;  // Split the count by first move
+          arg++;
+        }
+        if (token_count > arg) {  // Takes a depth argument to test deeper
+          depth = strtol(tok[arg], (char **)NULL, 10);
         }
-        do_perft(gme, depth, 0);
+        do_perft(gme, depth, divide);
         continue;
       }
 
@@ -2,9 +2,12 @@
 
 #include "./move_gen.h"
 
+#include <cilk/cilk.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
@@ -18,33 +21,6 @@
 #define MAX(x, y)  ((x) > (y) ? (x) : (y))
 #define MIN(x, y)  ((x) < (y) ? (x) : (y))
 
-// square table definition
-
-
-// 16x16 square table
-const int large_square_table[8][8] = {
-  {68, 69, 70, 71, 72, 73, 74, 75},
-  {84, 85, 86, 87, 88, 89, 90, 91},
-  {100, 101, 102, 103, 104, 105, 106, 107},
-  {116, 117, 118, 119, 120, 121, 122, 123},
-  {132, 133, 134, 135, 136, 137, 138, 139},
-  {148, 149, 150, 151, 152, 153, 154, 155},
-  {164, 165, 166, 167, 168, 169, 170, 171},
-  {180, 181, 182, 183, 184, 185, 186, 187}
-};
-
-// 10X10
-const int square_table[BOARD_WIDTH][BOARD_WIDTH] = {
-  {11, 12, 13, 14, 15, 16, 17, 18},
-  {21, 22, 23, 24, 25, 26, 27, 28},
-  {31, 32, 33, 34, 35, 36, 37, 38},
-  {41, 42, 43, 44, 45, 46, 47, 48},
-  {51, 52, 53, 54, 55, 56, 57, 58},
-  {61, 62, 63, 64, 65, 66, 67, 68},
-  {71, 72, 73, 74, 75, 76, 77, 78},
-  {81, 82, 83, 84, 85, 86, 87, 88}
-};
-
 int USE_KO;                     // Respect the Ko rule
 
 static char *color_strs[2] = { "White", "Black" };
@@ -104,84 +80,39 @@ void set_ori(piece_t * x, int ori) {
   *x = ((ori & ORI_MASK) << ORI_SHIFT) | (*x & ~(ORI_MASK << ORI_SHIFT));
 }
 
-void set_rank_and_file(position_t * p, square_t sq) {
-  int rank = rnk_of(sq);
-  int file = fil_of(sq);
-
-  p->files[file] |= (1 << rank);
-  p->ranks[rank] |= (1 << file);
-}
-
-void remove_rank_and_file(position_t * p, square_t sq) {
+// Adds piece x on square sq to the bitboards, or removes it if it is there.
+void toggle_piece_bb(position_t * p, square_t sq, piece_t x) {
+  tbassert(ptype_of(x) == PAWN || ptype_of(x) == KING,
+           "ptype: %d\n", ptype_of(x));
   int rank = rnk_of(sq);
   int file = fil_of(sq);
+  bitboard_t bit = bb_bit(file, rank);
 
-  p->files[file] &= ~(1 << rank);
-  p->ranks[rank] &= ~(1 << file);
+  p->occupied ^= bit;
+  p->occupied_t ^= bb_bit(rank, file);
+  p->color_bb[color_of(x)] ^= bit;
+  if (ptype_of(x) == PAWN) {
+    p->pawn_bb ^= bit;
+  }
 }
 
-// find the location of next piece along the laser path 
-// return 0 if go out of the board
-square_t next_piece(position_t * p, square_t current, king_ori_t dir) {
-  int rank = rnk_of(current);
-  int file = fil_of(current);
-
-  switch (dir) {
-    case NN:{
-        uint8_t bit_array = p->files[file];
-        uint8_t bits_left = bit_array >> (rank + 1);
-        if (bits_left == 0) {   // laser goes out of the board
-          return 0;  
-        } else {
-          int trailing_zeros = __builtin_ctz(bits_left);
-          return current + trailing_zeros + 1;      // location of next piece 
-        }
-      }
-    case SS:{
-        uint8_t bit_array = p->files[file];
-        uint8_t bits_left = bit_array << (8 - rank);
-        if (bits_left == 0) {   // laser goes out of the board
-          return 0; 
-        } else {
-          int leading_zeros = __builtin_clz(bits_left) - 24;    // __builtin_clz is for 32 bit unsigned int  
-          tbassert(((file + FIL_ORIGIN) * ARR_WIDTH + RNK_ORIGIN + rank -
-                    leading_zeros - 1) < ARR_SIZE
-                   && ((file + FIL_ORIGIN) * ARR_WIDTH + RNK_ORIGIN + rank -
-                       leading_zeros - 1) >= 0,
-                   "file:%d, rank: %d, bits_left: %d, bit_array: %d, leading zeros: %d\n",
-                   file, rank, bits_left, bit_array, leading_zeros);
-          return current - leading_zeros - 1;       // location of next piece 
-        }
-      }
-    case WW:{
-        uint8_t bit_array = p->ranks[rank];
-        uint8_t bits_left = bit_array << (8 - file);
-        if (bits_left == 0) {   // laser goes out of the board
-          return 0;
-        } else {
-          int leading_zeros = __builtin_clz(bits_left) - 24;    // __builtin_clz is for 32 bit unsigned int 
-          tbassert(((file + FIL_ORIGIN - leading_zeros - 1) * ARR_WIDTH +
-                    RNK_ORIGIN + rank) < ARR_SIZE
-                   && ((file + FIL_ORIGIN - leading_zeros - 1) * ARR_WIDTH +
-                       RNK_ORIGIN + rank) >= 0, "error\n");
-          return current - (leading_zeros + 1) * ARR_WIDTH;      // location of next piece 
-        }
-      }
-    case EE:{
-        uint8_t bit_array = p->ranks[rank];
-        uint8_t bits_left = bit_array >> (file + 1);
-        if (bits_left == 0) {   // laser goes out of the board
-          return 0;
-        } else {
-          int trailing_zeros = __builtin_ctz(bits_left);
-          return current + (trailing_zeros + 1) * ARR_WIDTH;     // location of next piece 
-        }
+// Debugging function: checks that the bitboards agree with the board.
+bool bitboards_match_board(position_t * p) {
+  position_t q;
+  q.occupied = q.occupied_t = q.pawn_bb = 0;
+  q.color_bb[WHITE] = q.color_bb[BLACK] = 0;
+  for (fil_t f = 0; f < BOARD_WIDTH; f++) {
+    for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
+      square_t sq = square_of(f, r);
+      if (ptype_of(p->board[sq]) != EMPTY) {
+        toggle_piece_bb(&q, sq, p->board[sq]);
       }
-
-    default:
-      tbassert(false, "error");
-      return -1;
+    }
   }
+  return (q.occupied == p->occupied && q.occupied_t == p->occupied_t &&
+          q.pawn_bb == p->pawn_bb &&
+          q.color_bb[WHITE] == p->color_bb[WHITE] &&
+          q.color_bb[BLACK] == p->color_bb[BLACK]);
 }
 
 // -----------------------------------------------------------------------------
@@ -221,8 +152,7 @@ uint64_t compute_zob_key(position_t * p) {
   uint64_t key = 0;
   for (fil_t f = 0; f < BOARD_WIDTH; f++) {
     for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
-      square_t sq = square_table[f][r];
-      // key ^= zob[square_table[f][r]][p->board[sq]];
+      square_t sq = square_at(f, r);
       key ^= zob[sq][p->board[sq]];
     }
   }
@@ -247,7 +177,7 @@ void init_zob() {
 
 // // For no square, use 0, which is guaranteed to be off board
 square_t square_of(fil_t f, rnk_t r) {
-  square_t s = ARR_WIDTH * (FIL_ORIGIN + f) + RNK_ORIGIN + r;
+  square_t s = square_at(f, r);
   DEBUG_LOG(1, "Square of (file %d, rank %d) is %d\n", f, r, s);
   tbassert((s >= 0) && (s < ARR_SIZE), "s: %d\n", s);
   return s;
@@ -278,6 +208,51 @@ int dir_of(int i) {
   return dir[i];
 }
 
+// The moves of a King and of a Pawn on each square, in the order
+// generate_all emits them: the steps to the neighboring squares in dir_of()
+// order, then the rotations, including the null move for the King.  Rows
+// are copied whole, so only the first num_neighbors[sq] + 4 (King) or + 3
+// (Pawn) entries of a row mean anything.
+#define MAX_PIECE_MOVES 12
+static sortable_move_t king_moves[ARR_SIZE][MAX_PIECE_MOVES];
+static sortable_move_t pawn_moves[ARR_SIZE][MAX_PIECE_MOVES];
+static uint8_t num_neighbors[ARR_SIZE];
+
+// neighbor_bb[sq]: the squares next to sq.
+bitboard_t neighbor_bb[ARR_SIZE];
+
+// king_area[sq]: the squares a King on sq can move to, plus sq itself.
+bitboard_t king_area[ARR_SIZE];
+
+void init_move_tables() {
+  for (fil_t f = 0; f < BOARD_WIDTH; f++) {
+    for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
+      square_t sq = square_of(f, r);
+      int n = 0;
+      neighbor_bb[sq] = 0;
+      for (int d = 0; d < 8; d++) {
+        square_t dest = sq + dir_of(d);
+        if (fil_of(dest) < 0 || fil_of(dest) >= BOARD_WIDTH ||
+            rnk_of(dest) < 0 || rnk_of(dest) >= BOARD_WIDTH) {
+          continue;             // illegal square
+        }
+        neighbor_bb[sq] |= square_bb(dest);
+        king_moves[sq][n] = move_of(KING, (rot_t) 0, sq, dest);
+        pawn_moves[sq][n] = move_of(PAWN, (rot_t) 0, sq, dest);
+        n++;
+      }
+      num_neighbors[sq] = n;
+      king_area[sq] = neighbor_bb[sq] | square_bb(sq);
+      for (int rot = 0; rot < 4; ++rot) {
+        king_moves[sq][n + rot] = move_of(KING, (rot_t) rot, sq, sq);
+      }
+      for (int rot = 1; rot < 4; ++rot) {
+        pawn_moves[sq][n + rot - 1] = move_of(PAWN, (rot_t) rot, sq, sq);
+      }
+    }
+  }
+}
+
 // directions for laser: NN, EE, SS, WW
 
 // extern inline int beam_of(int direction);
@@ -305,6 +280,164 @@ int reflect_of(int beam_dir, int pawn_ori) {
   return reflect[beam_dir][pawn_ori];
 }
 
+// -----------------------------------------------------------------------------
+// Laser lookup tables
+// -----------------------------------------------------------------------------
+
+// laser_step[d][i][line]: how many squares a beam starting at index i of a
+// line (a file or a rank) with occupancy line travels before it reaches a
+// piece, or 0 if it goes out of the board.  d is 0 for beams towards higher
+// indices (NN, EE) and 1 for beams towards lower ones (SS, WW), i.e. dir >> 1.
+static int8_t laser_step[2][BOARD_WIDTH][1 << BOARD_WIDTH];
+
+// laser_turn[dir][x]: the direction of a beam travelling in direction dir
+// after it reaches piece x, or -1 if the beam stops there (back of a pawn, or
+// a king).  This is reflect[][] composed with decoding the piece.
+int8_t laser_turn[NUM_ORI][1 << PIECE_SIZE];
+
+// laser_ray[dir][sq]: the squares beyond sq in direction dir, up to the edge
+// of the board.
+bitboard_t laser_ray[NUM_ORI][ARR_SIZE];
+
+void init_laser_tables() {
+  for (int i = 0; i < BOARD_WIDTH; i++) {
+    for (int line = 0; line < (1 << BOARD_WIDTH); line++) {
+      laser_step[0][i][line] = 0;
+      for (int j = i + 1; j < BOARD_WIDTH; j++) {
+        if ((line >> j) & 1) {
+          laser_step[0][i][line] = j - i;
+          break;
+        }
+      }
+      laser_step[1][i][line] = 0;
+      for (int j = i - 1; j >= 0; j--) {
+        if ((line >> j) & 1) {
+          laser_step[1][i][line] = i - j;
+          break;
+        }
+      }
+    }
+  }
+
+  for (int dir = 0; dir < NUM_ORI; dir++) {
+    for (int x = 0; x < (1 << PIECE_SIZE); x++) {
+      laser_turn[dir][x] = (ptype_of(x) == PAWN) ? reflect[dir][ori_of(x)] : -1;
+    }
+
+    int df = (dir == EE) - (dir == WW);
+    int dr = (dir == NN) - (dir == SS);
+    for (fil_t f = 0; f < BOARD_WIDTH; f++) {
+      for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
+        bitboard_t ray = 0;
+        for (int ff = f + df, rr = r + dr;
+             ff >= 0 && ff < BOARD_WIDTH && rr >= 0 && rr < BOARD_WIDTH;
+             ff += df, rr += dr) {
+          ray |= bb_bit(ff, rr);
+        }
+        laser_ray[dir][square_of(f, r)] = ray;
+      }
+    }
+  }
+}
+
+// find the location of next piece along the laser path
+// return 0 if go out of the board
+square_t next_piece(position_t * p, square_t current, king_ori_t dir) {
+  tbassert(dir >= 0 && dir < NUM_ORI, "dir: %d\n", dir);
+  int i;
+  int line;
+  if ((dir & 1) == 0) {         // NN or SS: along the file
+    i = rnk_of(current);
+    line = (p->occupied >> (fil_of(current) * BOARD_WIDTH)) & BB_FILE_MASK;
+  } else {                      // EE or WW: ranks are bytes of occupied_t
+    i = fil_of(current);
+    line = (p->occupied_t >> (rnk_of(current) * BOARD_WIDTH)) & BB_FILE_MASK;
+  }
+  int step = laser_step[dir >> 1][i][line];
+  return step ? current + step * beam[dir] : 0;
+}
+
+// -----------------------------------------------------------------------------
+// Laser state
+// -----------------------------------------------------------------------------
+
+// Traces the laser of color c until it hits a piece or goes off the board,
+// and records it in p->laser.
+void trace_laser(position_t * p, color_t c) {
+  square_t sq = p->kloc[c];
+  int bdir = ori_of(p->board[sq]);
+  bitboard_t path = square_bb(sq);
+  bitboard_t reflecting = 0;
+  square_t hit = 0;
+
+  tbassert(ptype_of(p->board[sq]) == KING,
+           "ptype: %d\n", ptype_of(p->board[sq]));
+
+  while (true) {
+    square_t next_sq = next_piece(p, sq, bdir);
+    if (next_sq == 0) {         // Ran off edge of board
+      path |= laser_ray[bdir][sq];
+      break;
+    }
+    path |= laser_ray[bdir][sq] & ~laser_ray[bdir][next_sq];
+    sq = next_sq;
+
+    tbassert(ptype_of(p->board[sq]) == PAWN || ptype_of(p->board[sq]) == KING,
+             "invalid piece\n");
+
+    bdir = laser_turn[bdir][p->board[sq]];
+    if (bdir < 0) {             // Hit back of Pawn, or a King
+      hit = sq;
+      break;
+    }
+    reflecting |= square_bb(sq);
+  }
+
+  p->laser.path[c] = path;
+  p->laser.pinned[c] = reflecting & p->color_bb[opp_color(c)];
+  p->laser.hit[c] = hit;
+  p->laser.valid |= 1 << c;
+}
+
+// Returns the path/line-of-sight of the laser until it hits a piece or goes
+// off the board, including the king's own square and the piece hit.
+//
+// p : Current board state.
+// c : Color of king shooting laser.
+bitboard_t laser_path_bb(position_t * p, color_t c) {
+  if (!laser_known(p, c)) {
+    trace_laser(p, c);
+  }
+  return p->laser.path[c];
+}
+
+// p : Current board state.
+// c : Color of king shooting laser.
+// return the pawns of the opposite side pinned by color c's king, i.e. the
+// pawns that reflect its laser
+bitboard_t generate_pinned_pawns(position_t * p, color_t c) {
+  if (!laser_known(p, c)) {
+    trace_laser(p, c);
+  }
+  return p->laser.pinned[c];
+}
+
+// Checks that the laser entries p claims to know match a fresh trace.
+bool laser_state_is_current(position_t * p) {
+  position_t q = *p;
+  for (color_t c = WHITE; c <= BLACK; c++) {
+    if (laser_known(p, c)) {
+      trace_laser(&q, c);
+      if (q.laser.path[c] != p->laser.path[c] ||
+          q.laser.pinned[c] != p->laser.pinned[c] ||
+          q.laser.hit[c] != p->laser.hit[c]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 // -----------------------------------------------------------------------------
 // Move getters and setters
 // -----------------------------------------------------------------------------
@@ -347,6 +480,22 @@ void move_to_str(move_t mv, char *buf, size_t bufsize) {
   }
 }
 
+// The move of p that move_to_str() writes as mvstring, ignoring case, or 0 if
+// there is none.
+move_t move_from_str(position_t *p, const char *mvstring) {
+  sortable_move_t lst[MAX_NUM_MOVES];
+  int move_count = generate_all(p, lst, true);
+
+  for (int i = 0; i < move_count; i++) {
+    char buf[MAX_CHARS_IN_MOVE];
+    move_to_str(get_move(lst[i]), buf, MAX_CHARS_IN_MOVE);
+    if (strcasecmp(buf, mvstring) == 0) {
+      return get_move(lst[i]);
+    }
+  }
+  return 0;
+}
+
 // sort of the move list.
 void sort_move_list(sortable_move_t * move_list, int num_of_moves, int mv_index) {
   for (int j = 0; j < num_of_moves; j++) {
@@ -511,6 +660,8 @@ static inline int enumerate_moves(position_t * p,
 // Move generation
 // -----------------------------------------------------------------------------
 
+static inline square_t fire_laser(position_t * p, color_t c);
+
 // print output of square_of
 void print_square_table() {
   for (fil_t f = 0; f < BOARD_WIDTH; ++f) {
@@ -531,73 +682,126 @@ int generate_all(position_t * p, sortable_move_t * sortable_move_list,
   color_t color_to_move = color_to_move_of(p);
   color_t opposite_color = opp_color(color_to_move);
 
-  square_t pinned_pawn_list[MAX_PAWNS];
-  int pinned_pawn_count =
-    generate_pinned_pawn_list(p, opposite_color, pinned_pawn_list);
+  bitboard_t pinned_pawns = generate_pinned_pawns(p, opposite_color);
   int move_count = 0;
 
-  // collect all king's moves
+  // collect all king's moves and rotations, including the null move
   square_t king_loc = p->kloc[color_to_move];
   tbassert(ptype_of(p->board[king_loc]) == KING,
            "ptype: %d\n", ptype_of(p->board[king_loc]));
-  for (int d = 0; d < 8; d++) {
-    int dest = king_loc + dir_of(d);
-    // Skip moves into invalid squares
-    if (ptype_of(p->board[dest]) == INVALID) {
-      continue;                 // illegal square
-    }
-    tbassert(move_count < MAX_NUM_MOVES, "move_count: %d\n", move_count);
-    sortable_move_list[move_count++] = move_of(KING, (rot_t) 0, king_loc, dest);
+  memcpy(sortable_move_list, king_moves[king_loc],
+         sizeof(king_moves[king_loc]));
+  move_count += num_neighbors[king_loc] + 4;
+
+  // collect all pawns' moves, except for pawns pinned by the enemy laser
+  for (bitboard_t pawns = pawns_bb_of(p, color_to_move) & ~pinned_pawns;
+       pawns != 0; pawns &= pawns - 1) {
+    square_t pawn_loc = bb_square(bb_ctz(pawns));
+    tbassert(ptype_of(p->board[pawn_loc]) == PAWN,
+             "ptype: %d\n", ptype_of(p->board[pawn_loc]));
+    tbassert(move_count + MAX_PIECE_MOVES <= MAX_NUM_MOVES,
+             "move_count: %d\n", move_count);
+
+    memcpy(&(sortable_move_list[move_count]), pawn_moves[pawn_loc],
+           sizeof(pawn_moves[pawn_loc]));
+    move_count += num_neighbors[pawn_loc] + 3;
   }
-  // rotations - four directions possible.
-  // King also generates null move.
-  for (int rot = 0; rot < 4; ++rot) {
-    tbassert(move_count < MAX_NUM_MOVES, "move_count: %d\n", move_count);
-    sortable_move_list[move_count++] =
-      move_of(KING, (rot_t) rot, king_loc, king_loc);
+  tbassert(move_count < MAX_NUM_MOVES, "move_count: %d\n", move_count);
+  return move_count;
+}
+
+// Generate the moves from position p that can zap a piece.  Returns number of
+// moves.
+//
+// Only the side to move fires its laser, and the laser path depends only on
+// the contents of the squares it passes through.  So if the laser currently
+// leaves the board, a move can only zap something if it moves the king, or
+// moves or rotates a piece on the path, or moves a piece onto the path.  If
+// the laser already hits a piece, nearly every move zaps it and all moves are
+// generated.
+//
+// https://chessprogramming.wikispaces.com/Quiescence+Search
+int generate_captures(position_t * p, sortable_move_t * sortable_move_list) {
+  color_t color_to_move = color_to_move_of(p);
+  color_t opposite_color = opp_color(color_to_move);
+
+  if (fire_laser(p, color_to_move) != 0) {
+    return generate_all(p, sortable_move_list, false);
   }
+  bitboard_t laser_path = laser_path_bb(p, color_to_move);
+
+  bitboard_t pinned_pawns = generate_pinned_pawns(p, opposite_color);
+  int move_count = 0;
 
-  // collect all pawns' moves
-  pawns_t pawns = p->ploc[color_to_move];
-  int num_pawns = pawns.pawns_count;
+  // every king move or rotation changes where the laser starts, but the null
+  // move does not
+  square_t king_loc = p->kloc[color_to_move];
+  tbassert(ptype_of(p->board[king_loc]) == KING,
+           "ptype: %d\n", ptype_of(p->board[king_loc]));
+  int num_steps = num_neighbors[king_loc];
+  memcpy(sortable_move_list, king_moves[king_loc],
+         sizeof(king_moves[king_loc]));
+  move_count += num_steps;
+  for (int rot = 1; rot < 4; ++rot) {   // skip the null move
+    sortable_move_list[move_count++] = king_moves[king_loc][num_steps + rot];
+  }
 
-  for (int i = 0; i < num_pawns; i++) {
-    square_t pawn_loc = pawns.squares[i];
+  for (bitboard_t pawns = pawns_bb_of(p, color_to_move) & ~pinned_pawns;
+       pawns != 0; pawns &= pawns - 1) {
+    square_t pawn_loc = bb_square(bb_ctz(pawns));
     tbassert(ptype_of(p->board[pawn_loc]) == PAWN,
              "ptype: %d\n", ptype_of(p->board[pawn_loc]));
 
-    // if this pawn is pinned, do not generate moves
-    bool pinned_flag = false;
-    for (int j = 0; j < pinned_pawn_count; j++) {
-      if (pinned_pawn_list[j] == pawn_loc) {
-        pinned_flag = true;
-        break;
-      }
-    }
-    if (pinned_flag) {
-      continue;
-    }
-    // otherwise, generate moves
-    for (int d = 0; d < 8; d++) {
-      int dest = pawn_loc + dir_of(d);
-      // Skip moves into invalid squares
-      if (ptype_of(p->board[dest]) == INVALID) {
-        continue;               // illegal square
+    if (laser_path & square_bb(pawn_loc)) {   // every move changes the path
+      memcpy(&(sortable_move_list[move_count]), pawn_moves[pawn_loc],
+             sizeof(pawn_moves[pawn_loc]));
+      move_count += num_neighbors[pawn_loc] + 3;
+    } else if (laser_path & neighbor_bb[pawn_loc]) {  // steps onto the path
+      for (int i = 0; i < num_neighbors[pawn_loc]; i++) {
+        sortable_move_t mv = pawn_moves[pawn_loc][i];
+        if (laser_path & square_bb(to_square(mv))) {
+          sortable_move_list[move_count++] = mv;
+        }
       }
-      sortable_move_list[move_count++] =
-        move_of(PAWN, (rot_t) 0, pawn_loc, dest);
-    }
-
-    // rotations - three directions possible
-    for (int rot = 1; rot < 4; ++rot) {
-      sortable_move_list[move_count++] =
-        move_of(PAWN, (rot_t) rot, pawn_loc, pawn_loc);
     }
   }
   tbassert(move_count < MAX_NUM_MOVES, "move_count: %d\n", move_count);
   return move_count;
 }
 
+// Returns true if mv is one of the moves generate_all would produce in p.
+// Hash and killer moves come from other positions, and this lets the search
+// try them without generating the whole move list first.
+bool move_is_pseudo_legal(position_t *p, move_t mv) {
+  square_t fs = from_square(mv);
+  square_t ts = to_square(mv);
+  rot_t ro = rot_of(mv);
+  ptype_t pce = ptype_mv_of(mv);
+  color_t color_to_move = color_to_move_of(p);
+
+  if (mv == 0 || fs >= ARR_SIZE || ts >= ARR_SIZE) {
+    return false;
+  }
+  if ((pce != PAWN && pce != KING) || ptype_of(p->board[fs]) != pce ||
+      color_of(p->board[fs]) != color_to_move) {
+    return false;
+  }
+
+  if (fs == ts) {  // rotation, or the null move for a king
+    if (pce == PAWN && ro == NONE) {
+      return false;
+    }
+  } else if (ro != NONE || ptype_of(p->board[ts]) == INVALID ||
+             !(neighbor_bb[fs] & square_bb(ts))) {
+    return false;
+  }
+
+  // pawns pinned by the enemy laser cannot move
+  return pce != PAWN ||
+         !(generate_pinned_pawns(p, opp_color(color_to_move)) &
+           square_bb(fs));
+}
+
 // // -----------------------------------------------------------------------------
 // // Move execution
 // // -----------------------------------------------------------------------------
@@ -646,75 +850,29 @@ int generate_all(position_t * p, sortable_move_t * sortable_move_list,
 // -----------------------------------------------------------------------------
 
 // Returns the square of piece that would be zapped by the laser if fired once,
-// or 0 if no such piece exists.
+// or 0 if no such piece exists.  The laser is traced only if p does not know
+// it yet.
 //
 // p : Current board state.
 // c : Color of king shooting laser.
 static inline square_t fire_laser(position_t * p, color_t c) {
-  // color_t fake_color_to_move = (color_to_move_of(p) == WHITE) ? BLACK : WHITE;0
-  square_t sq = p->kloc[c];
-  int bdir = ori_of(p->board[sq]);
-
-  tbassert(ptype_of(p->board[sq]) == KING,
-           "ptype: %d\n", ptype_of(p->board[sq]));
-
-  while (true) {
-    sq = next_piece(p, sq, bdir);
-    tbassert(sq < ARR_SIZE && sq >= 0, "sq: %d\n", sq);
-    if (sq == 0) {
-      return 0;
-    }
-
-    piece_t current_piece = ptype_of(p->board[sq]);
-    tbassert(current_piece == PAWN || current_piece == KING, "invalid piece\n");
-
-    if (current_piece == PAWN) {
-      // int oldbdir = bdir;
-      bdir = reflect[bdir][ori_of(p->board[sq])];
-      // tbassert(bdir == reflect_of(oldbdir, ori_of(p->board[sq])), "\n");
-      if (bdir < 0) {           // Hit back of Pawn
-        return sq;
-      }
-    } else {
-      return sq;
-    } 
+  if (!laser_known(p, c)) {
+    trace_laser(p, c);
   }
+  return p->laser.hit[c];
 }
 
-// maintain pawn list in sorted order
-// might want to remove later because default ordering not necessarily better
-// ie no reason that sorted is better than unsorted
-void sort_pawns(position_t * p, color_t color, int incorrect_index) {
-  int num_squares = p->ploc[color].pawns_count;
-
-  // go to the left if we need to swap
-  int left = incorrect_index - 1;
-  while (left >= 0 &&
-         (compare_sq(p->ploc[color].squares[left],
-                     p->ploc[color].squares[incorrect_index]) == 1)) {
-    // swap left and current incorrect
-    square_t left_square = p->ploc[color].squares[left];
-    p->ploc[color].squares[left] = p->ploc[color].squares[incorrect_index];
-    p->ploc[color].squares[incorrect_index] = left_square;
-    left--;
-    incorrect_index--;
-  }
+static inline void move_piece(position_t * p, move_t mv);
 
-  // otherwise, check to the right if we need to swap
-  int right = incorrect_index + 1;
-  while (right < num_squares &&
-         (compare_sq(p->ploc[color].squares[incorrect_index],
-                     p->ploc[color].squares[right]) == 1)) {
-    // swap right and current incorrect
-    square_t right_square = p->ploc[color].squares[right];
-    p->ploc[color].squares[right] = p->ploc[color].squares[incorrect_index];
-    p->ploc[color].squares[incorrect_index] = right_square;
-    right++;
-    incorrect_index++;
+// Marks the lasers that pass through any of squares as no longer known.
+static inline void forget_lasers_through(position_t * p, bitboard_t squares) {
+  for (int c = WHITE; c <= BLACK; c++) {
+    if (p->laser.path[c] & squares) {
+      p->laser.valid &= ~(1 << c);
+    }
   }
 }
 
-
 void low_level_make_move(position_t * old, position_t * p, move_t mv) {
   tbassert(mv != 0, "mv was zero.\n");
 
@@ -733,6 +891,29 @@ void low_level_make_move(position_t * old, position_t * p, move_t mv) {
                      display(old);
                      });
 
+  *p = *old;
+  
+  p->history = old;
+  p->last_move = mv;
+  move_piece(p, mv);
+
+  tbassert(p->key == compute_zob_key(p),
+           "p->key: %" PRIu64 ", zob-key: %" PRIu64 "\n",
+           p->key, compute_zob_key(p));
+  tbassert(bitboards_match_board(p), "bitboards out of sync\n");
+
+  WHEN_DEBUG_VERBOSE( {
+                     fprintf(stderr, "After:\n");
+                     display(p);
+                     }
+  );
+}
+
+// Moves or rotates the piece, updating the board, hash key, bitboards, king
+// locations and ply of p in place.  Phase 1 of a move.
+static inline void move_piece(position_t * p, move_t mv) {
+  WHEN_DEBUG_VERBOSE(char buf[MAX_CHARS_IN_MOVE]);
+
   square_t from_sq = from_square(mv);
   square_t to_sq = to_square(mv);
   rot_t rot = rot_of(mv);
@@ -762,11 +943,6 @@ void low_level_make_move(position_t * old, position_t * p, move_t mv) {
                      }
                     });
 
-  *p = *old;
-  
-  p->history = old;
-  p->last_move = mv;
-
   tbassert(from_sq < ARR_SIZE && from_sq > 0, "from_sq: %d\n", from_sq);
   tbassert(p->board[from_sq] < (1 << PIECE_SIZE) && p->board[from_sq] >= 0,
            "p->board[from_sq]: %d\n", p->board[from_sq]);
@@ -791,81 +967,30 @@ void low_level_make_move(position_t * old, position_t * p, move_t mv) {
     p->key ^= zob[from_sq][to_piece];   // place to_piece in from_sq
 
 
-    ptype_t from_ptype = ptype_of(from_piece);
     ptype_t to_ptype = ptype_of(to_piece);
-    color_t from_color = color_of(from_piece);
-    color_t to_color = color_of(to_piece);
 
-    // update p->ranks and p->files
-    tbassert(from_ptype != INVALID && to_ptype != INVALID,
-             "Error: from_ptype or to_ptype is INVALID");
-    tbassert(from_ptype == PAWN || from_ptype == KING,
+    tbassert(to_ptype != INVALID, "Error: to_ptype is INVALID");
+    tbassert(ptype_of(from_piece) == PAWN || ptype_of(from_piece) == KING,
              "Error: from_ptype should be either PAWN or KING");
 
-    int from_rank = rnk_of(from_sq);
-    int from_file = fil_of(from_sq);
-    int to_rank = rnk_of(to_sq);
-    int to_file = fil_of(to_sq);
-
-    if (to_ptype == EMPTY) {
-      // add the new piece
-      p->ranks[to_rank] |= (1 << to_file);
-      p->files[to_file] |= (1 << to_rank);
-
-      // remove the old piece
-      p->ranks[from_rank] &= ~(1 << from_file);
-      p->files[from_file] &= ~(1 << from_rank);
+    // update the bitboards
+    toggle_piece_bb(p, from_sq, from_piece);
+    toggle_piece_bb(p, to_sq, from_piece);
+    if (to_ptype != EMPTY) {
+      toggle_piece_bb(p, to_sq, to_piece);
+      toggle_piece_bb(p, from_sq, to_piece);
     }
 
-    // Update Pawn locations if necessary
-    if (from_ptype == PAWN) {
-      if (to_ptype == PAWN) {
-        if (from_color != to_color) {
-          // If both squares are pawns, we don't have to update the pawn arrays
-          // if the pawns are the same color.
-          // If the pawns are different colors, then we need to swap the squares
-          // in the arrays.
-
-          // First, get the index of the from-pawn.
-          tbassert(p->ploc[from_color].pawns_map[from_file][from_rank] >=0 && 
-                   p->ploc[from_color].pawns_map[from_file][from_rank] < p->ploc[from_color].pawns_count,
-                   "Error: the index of pawn is INVALID");
-          int i = p->ploc[from_color].pawns_map[from_file][from_rank];
-
-          // Second, get the index of the to-pawn.
-          tbassert(p->ploc[to_color].pawns_map[to_file][to_rank] >=0 && 
-                   p->ploc[to_color].pawns_map[to_file][to_rank] < p->ploc[to_color].pawns_count,
-                   "Error: the index of pawn is INVALID");
-          int j = p->ploc[to_color].pawns_map[to_file][to_rank];
-          p->ploc[from_color].squares[i] = to_sq;
-          p->ploc[to_color].squares[j] = from_sq;
-
-          // update pawns_map
-          p->ploc[from_color].pawns_map[from_file][from_rank] = MAX_PAWNS;
-          p->ploc[from_color].pawns_map[to_file][to_rank] = i;
-          p->ploc[to_color].pawns_map[to_file][to_rank] = MAX_PAWNS;
-          p->ploc[to_color].pawns_map[from_file][from_rank] = j;
-        }
-      } else {
-        // The from-square is a pawn and the to-square is not a pawn.
-        tbassert(p->ploc[from_color].pawns_map[from_file][from_rank] >=0 && 
-                 p->ploc[from_color].pawns_map[from_file][from_rank] < p->ploc[from_color].pawns_count,
-                 "Error: the index of pawn is INVALID");
-        int i = p->ploc[from_color].pawns_map[from_file][from_rank];
-        p->ploc[from_color].squares[i] = to_sq;
-        p->ploc[from_color].pawns_map[from_file][from_rank] = MAX_PAWNS;
-        p->ploc[from_color].pawns_map[to_file][to_rank] = i;
-      }
-    } else if (to_ptype == PAWN) {
-      // The to-square is a pawn and the from-square is not a pawn.
-      tbassert(p->ploc[to_color].pawns_map[to_file][to_rank] >=0 && 
-               p->ploc[to_color].pawns_map[to_file][to_rank] < p->ploc[to_color].pawns_count,
-               "Error: the index of pawn is INVALID"); 
-      int j = p->ploc[to_color].pawns_map[to_file][to_rank];   
-      p->ploc[to_color].squares[j] = from_sq; 
-      p->ploc[to_color].pawns_map[to_file][to_rank] = MAX_PAWNS;
-      p->ploc[to_color].pawns_map[from_file][from_rank] = j;
+    // update the running eval sums
+    if (ptype_of(from_piece) == PAWN) {
+      update_pawn_terms(p, color_of(from_piece), from_sq, -1);
+      update_pawn_terms(p, color_of(from_piece), to_sq, 1);
+    }
+    if (to_ptype == PAWN) {
+      update_pawn_terms(p, color_of(to_piece), to_sq, -1);
+      update_pawn_terms(p, color_of(to_piece), from_sq, 1);
     }
+
     // Update King locations if necessary
     if (ptype_of(from_piece) == KING) {
       p->kloc[color_of(from_piece)] = to_sq;
@@ -882,35 +1007,37 @@ void low_level_make_move(position_t * old, position_t * p, move_t mv) {
     p->key ^= zob[from_sq][from_piece]; // ... and in hash
   }
 
+  // lasers not passing through from_sq or to_sq have not changed
+  forget_lasers_through(p, square_bb(from_sq) | square_bb(to_sq));
+
   // Increment ply
   p->ply++;
-
-  tbassert(p->key == compute_zob_key(p),
-           "p->key: %" PRIu64 ", zob-key: %" PRIu64 "\n",
-           p->key, compute_zob_key(p));
-
-  WHEN_DEBUG_VERBOSE( {
-                     fprintf(stderr, "After:\n");
-                     display(p);
-                     }
-  );
 }
 
-// return victims or KO
-victims_t make_move(position_t * old, position_t * p, move_t mv) {
-  tbassert(mv != 0, "mv was zero.\n");
+// Removes the piece on victim_sq, which was hit by the laser, from the board,
+// the hash key and the bitboards.
+static inline void remove_zapped_piece(position_t * p, square_t victim_sq) {
+  piece_t victim_piece = p->board[victim_sq];
+  p->key ^= zob[victim_sq][victim_piece];
+  p->board[victim_sq] = 0;
+  p->key ^= zob[victim_sq][0];
+  toggle_piece_bb(p, victim_sq, victim_piece);
+  if (ptype_of(victim_piece) == PAWN) {
+    update_pawn_terms(p, color_of(victim_piece), victim_sq, -1);
+  }
+  forget_lasers_through(p, square_bb(victim_sq));
+}
 
+// Fires the laser of color c and removes the pieces it zaps, recording them
+// in p->victims and, if zapped_sq is not NULL, their squares in zapped_sq.
+// Phase 2 of a move.
+static inline void zap_pieces(position_t * p, color_t c, uint8_t * zapped_sq) {
   WHEN_DEBUG_VERBOSE(char buf[MAX_CHARS_IN_MOVE]);
 
-  // move phase 1 - moving a piece
-  low_level_make_move(old, p, mv);
-
-  // move phase 2 - shooting the laser
   square_t victim_sq = 0;
   p->victims.zapped_count = 0;
 
-  color_t color_to_move = color_to_move_of(old);
-  while ((victim_sq = fire_laser(p, color_to_move))) {
+  while ((victim_sq = fire_laser(p, c))) {
     WHEN_DEBUG_VERBOSE( {
                        square_to_str(victim_sq, buf, MAX_CHARS_IN_MOVE);
                        DEBUG_LOG(1, "Zapping piece on %s\n", buf);
@@ -919,29 +1046,11 @@ victims_t make_move(position_t * old, position_t * p, move_t mv) {
 
     // we definitely hit something with laser, remove it from board
     piece_t victim_piece = p->board[victim_sq];
-    p->victims.zapped[p->victims.zapped_count++] = victim_piece;
-    p->key ^= zob[victim_sq][victim_piece];
-    p->board[victim_sq] = 0;
-    p->key ^= zob[victim_sq][0];
-
-    // remove the zapped piece
-    int victim_rank = rnk_of(victim_sq);
-    int victim_file = fil_of(victim_sq);
-    p->ranks[victim_rank] &= ~(1 << victim_file);
-    p->files[victim_file] &= ~(1 << victim_rank);
-
-    // If the victim piece is a pawn, remove it from the pawn array.
-    color_t color = color_of(victim_piece);
-    if (ptype_of(victim_piece) == PAWN) {
-      int i = p->ploc[color].pawns_map[victim_file][victim_rank];
-      p->ploc[color].squares[i] =
-        p->ploc[color].squares[p->ploc[color].pawns_count - 1]; 
-      // update pawns_map 
-      p->ploc[color].pawns_map[fil_of(p->ploc[color].squares[i])][rnk_of(p->ploc[color].squares[i])] = i;
-
-      p->ploc[color].pawns_count--;
-      p->ploc[color].pawns_map[victim_file][victim_rank] = MAX_PAWNS;
+    if (zapped_sq) {
+      zapped_sq[p->victims.zapped_count] = victim_sq;
     }
+    p->victims.zapped[p->victims.zapped_count++] = victim_piece;
+    remove_zapped_piece(p, victim_sq);
 
     tbassert(p->key == compute_zob_key(p),
              "p->key: %" PRIu64 ", zob-key: %" PRIu64 "\n",
@@ -957,6 +1066,21 @@ victims_t make_move(position_t * old, position_t * p, move_t mv) {
     if (ptype_of(victim_piece) == KING)
       break;
   }
+}
+
+// return victims or KO
+victims_t make_move(position_t * old, position_t * p, move_t mv) {
+  tbassert(mv != 0, "mv was zero.\n");
+
+  // move phase 1 - moving a piece
+  low_level_make_move(old, p, mv);
+
+  // move phase 2 - shooting the laser
+  zap_pieces(p, color_to_move_of(old), NULL);
+  tbassert(laser_state_is_current(p), "stale laser state\n");
+  tbassert(ev_terms_are_current(p), "stale eval sums\n");
+  p->rep_filter = (p->victims.zapped_count > 0) ?
+                  0 : (old->rep_filter | rep_bit(old->key));
 
   if (USE_KO && ((p->key == (old->key ^ zob_color))
                  || (p->key == old->history->key))) {
@@ -997,16 +1121,139 @@ victims_t make_move(position_t * old, position_t * p, move_t mv) {
   return p->victims;
 }
 
+// -----------------------------------------------------------------------------
+// In-place make/unmake
+// -----------------------------------------------------------------------------
+
+// Empties stack, which continues parent from its current top if parent is not
+// NULL.
+void init_undo_stack(undo_stack_t * stack, undo_stack_t * parent) {
+  stack->top = 0;
+  stack->parent = parent;
+  stack->parent_top = (parent != NULL) ? parent->top : 0;
+}
+
+// Same as make_move(), but changes p in place and pushes what is needed to
+// take the move back onto stack.  p->history is left alone; the keys of the
+// positions made in place are on the stack instead, and init_ancestor_walk()
+// finds them.
+victims_t make_move_in_place(position_t * p, move_t mv, undo_stack_t * stack) {
+  tbassert(mv != 0, "mv was zero.\n");
+  tbassert(stack->top < MAX_PLY_IN_SEARCH, "top: %d\n", stack->top);
+
+  // the key of the position before p, for the Ko rule
+  ancestor_walk_t w;
+  init_ancestor_walk(&w, p, stack);
+  ancestor_walk_next(&w);
+
+  undo_t *u = &(stack->undo[stack->top++]);
+  u->key = p->key;
+  u->rep_filter = p->rep_filter;
+  u->last_move = p->last_move;
+  u->victims = p->victims;
+  u->laser = p->laser;
+  u->ev = p->ev;
+  u->mv = mv;
+
+  color_t color_to_move = color_to_move_of(p);
+  p->last_move = mv;
+  move_piece(p, mv);
+  zap_pieces(p, color_to_move, u->zapped_sq);
+  tbassert(laser_state_is_current(p), "stale laser state\n");
+  tbassert(ev_terms_are_current(p), "stale eval sums\n");
+  p->rep_filter = (p->victims.zapped_count > 0) ?
+                  0 : (u->rep_filter | rep_bit(u->key));
+
+  if (USE_KO && ((p->key == (u->key ^ zob_color)) || (p->key == w.key))) {
+    return KO();
+  }
+  return p->victims;
+}
+
+// Takes back the last move made by make_move_in_place().
+void unmake_move(position_t * p, undo_stack_t * stack) {
+  tbassert(stack->top > 0, "top: %d\n", stack->top);
+  undo_t *u = &(stack->undo[--stack->top]);
+
+  // put the zapped pieces back, last one first
+  for (int i = p->victims.zapped_count - 1; i >= 0; i--) {
+    square_t sq = u->zapped_sq[i];
+    p->board[sq] = p->victims.zapped[i];
+    toggle_piece_bb(p, sq, p->board[sq]);
+  }
+
+  square_t from_sq = from_square(u->mv);
+  square_t to_sq = to_square(u->mv);
+  if (to_sq != from_sq) {       // move back, swapping again
+    piece_t from_piece = p->board[to_sq];
+    piece_t to_piece = p->board[from_sq];
+    p->board[from_sq] = from_piece;
+    p->board[to_sq] = to_piece;
+
+    toggle_piece_bb(p, to_sq, from_piece);
+    toggle_piece_bb(p, from_sq, from_piece);
+    if (ptype_of(to_piece) != EMPTY) {
+      toggle_piece_bb(p, from_sq, to_piece);
+      toggle_piece_bb(p, to_sq, to_piece);
+    }
+
+    if (ptype_of(from_piece) == KING) {
+      p->kloc[color_of(from_piece)] = from_sq;
+    }
+    if (ptype_of(to_piece) == KING) {
+      p->kloc[color_of(to_piece)] = to_sq;
+    }
+  } else {                      // rotate back
+    set_ori(&(p->board[from_sq]), ori_of(p->board[from_sq]) - rot_of(u->mv));
+  }
+
+  p->key = u->key;
+  p->rep_filter = u->rep_filter;
+  p->last_move = u->last_move;
+  p->victims = u->victims;
+  p->laser = u->laser;
+  p->ev = u->ev;
+  p->ply--;
+
+  tbassert(p->key == compute_zob_key(p),
+           "p->key: %" PRIu64 ", zob-key: %" PRIu64 "\n",
+           p->key, compute_zob_key(p));
+  tbassert(bitboards_match_board(p), "bitboards out of sync\n");
+  tbassert(laser_state_is_current(p), "stale laser state\n");
+  tbassert(ev_terms_are_current(p), "stale eval sums\n");
+}
+
 // -----------------------------------------------------------------------------
 // Move path enumeration (perft)
 // -----------------------------------------------------------------------------
 
-// Helper function for do_perft() (ply starting with 0).
+int PERFT_HASH;  // perft table size in MBytes, 0 for no table
+
+// A perft table entry: the number of move paths of some length from some
+// position.  check is the key xor'ed with count, so that an entry torn by two
+// strands writing it at once reads as a miss rather than as a wrong count.
+typedef struct perft_entry {
+  uint64_t check;
+  uint64_t count;
+} perft_entry_t;
+
+typedef struct perft_table {
+  perft_entry_t *entries;
+  uint64_t mask;  // maps a key to an entry index
+} perft_table_t;
+
+// Perft counts depend on the length of the paths as well as the position.
+static inline uint64_t perft_key(position_t * p, int depth) {
+  return p->key ^ ((uint64_t) depth * 0x9E3779B97F4A7C15ULL);
+}
+
+// Helper function for do_perft(): the number of move paths of length depth
+// from p, looked up in and stored to table unless it is NULL.
 //
-// NOTE: This function reimplements some of the logic for make_move().
-static uint64_t perft_search(position_t * p, int depth, int ply) {
+// The Ko rule is not applied, so every generated move is counted.
+static uint64_t perft_search(position_t * p, int depth, undo_stack_t * stack,
+                             perft_table_t * table) {
   uint64_t node_count = 0;
-  position_t np;
   sortable_move_t lst[MAX_NUM_MOVES];
   int num_moves;
   int i;
@@ -1015,6 +1262,17 @@ static uint64_t perft_search(position_t * p, int depth, int ply) {
     return 1;
   }
 
+  perft_entry_t *entry = NULL;
+  uint64_t key = 0;
+  if (table != NULL && depth >= 2) {
+    key = perft_key(p, depth);
+    entry = &(table->entries[key & table->mask]);
+    uint64_t count = entry->count;
+    if ((entry->check ^ count) == key) {
+      return count;
+    }
+  }
+
   num_moves = generate_all(p, lst, true);
 
   if (depth == 1) {
@@ -1024,70 +1282,99 @@ static uint64_t perft_search(position_t * p, int depth, int ply) {
   for (i = 0; i < num_moves; i++) {
     move_t mv = get_move(lst[i]);
 
-    low_level_make_move(p, &np, mv);    // make the move baby!
-
-    square_t victim_sq = 0;     // the guys to disappear
-    np.victims.zapped_count = 0;
-
-    while ((victim_sq = fire_laser(&np, color_to_move_of(p)))) {        // hit a piece
-      piece_t victim_piece = np.board[victim_sq];
-      tbassert((ptype_of(victim_piece) != EMPTY) &&
-               (ptype_of(victim_piece) != INVALID),
-               "type: %d\n", ptype_of(victim_piece));
-
-      np.victims.zapped[np.victims.zapped_count++] = victim_piece;
-      np.key ^= zob[victim_sq][victim_piece];   // remove from board
-      np.board[victim_sq] = 0;
-      np.key ^= zob[victim_sq][0];
-
-      // remove the zapped piece
-      int victim_rank = rnk_of(victim_sq);
-      int victim_file = fil_of(victim_sq);
-      p->ranks[victim_rank] &= ~(1 << victim_file);
-      p->files[victim_file] &= ~(1 << victim_rank);
-
-      // If the victim piece is a pawn, remove it from the pawn array.
-      color_t color = color_of(victim_piece);
-      if (ptype_of(victim_piece) == PAWN) {
-        int i = p->ploc[color].pawns_map[victim_file][victim_rank];
-        p->ploc[color].squares[i] =
-          p->ploc[color].squares[p->ploc[color].pawns_count - 1];
-        p->ploc[color].pawns_count--;
-        p->ploc[color].pawns_map[victim_file][victim_rank] = MAX_PAWNS;
-      }
-
-      if (ptype_of(victim_piece) == KING)
-        break;
-    }
+    make_move_in_place(p, mv, stack);   // make the move baby!
 
-    if (np.victims.zapped_count > 0 &&
-        ptype_of(np.victims.zapped[np.victims.zapped_count - 1]) == KING) {
+    if (p->victims.zapped_count > 0 &&
+        ptype_of(p->victims.zapped[p->victims.zapped_count - 1]) == KING) {
       // do not expand further: hit a King
       node_count++;
-      continue;
+    } else {
+      node_count += perft_search(p, depth - 1, stack, table);
     }
 
-    uint64_t partialcount = perft_search(&np, depth - 1, ply + 1);
-    node_count += partialcount;
+    unmake_move(p, stack);
   }
 
+  if (entry != NULL) {
+    entry->check = key ^ node_count;
+    entry->count = node_count;
+  }
   return node_count;
 }
 
+// The number of move paths of length depth from p that start with mv.  Works
+// on its own copy of p, so that the moves from one position can be counted in
+// parallel.
+static uint64_t perft_move(position_t * p, move_t mv, int depth,
+                           perft_table_t * table) {
+  if (depth == 1) {
+    return 1;
+  }
+
+  position_t np = *p;
+  undo_stack_t stack;
+  init_undo_stack(&stack, NULL);
+  make_move_in_place(&np, mv, &stack);
+
+  if (np.victims.zapped_count > 0 &&
+      ptype_of(np.victims.zapped[np.victims.zapped_count - 1]) == KING) {
+    return 1;                   // hit a King
+  }
+  return perft_search(&np, depth - 1, &stack, table);
+}
+
 // Debugging function to help verify that the move generator is working
-// correctly.
+// correctly, and a benchmark for make_move.
+//
+// Counts the move paths of each length up to depth from the starting
+// position.  With divide, counts only the paths of length depth, and prints
+// the count below each first move too.  The first moves are counted in
+// parallel, sharing a table of counts of PERFT_HASH MBytes.
 //
 // https://chessprogramming.wikispaces.com/Perft
-void do_perft(position_t * gme, int depth, int ply) {
+void do_perft(position_t * gme, int depth, bool divide) {
   fen_to_pos(gme, "");
 
-  for (int d = 1; d <= depth; d++) {
-    printf("perft %2d ", d);
-    uint64_t j = perft_search(gme, d, 0);
-    printf("%" PRIu64 "\n", j);
+  perft_table_t table = { NULL, 0 };
+  if (PERFT_HASH > 0) {
+    uint64_t num_of_entries =
+        ((uint64_t) PERFT_HASH << 20) / sizeof(perft_entry_t);
+    num_of_entries = 1ULL << (63 - __builtin_clzll(num_of_entries));
+    table.entries =
+        (perft_entry_t *) calloc(num_of_entries, sizeof(perft_entry_t));
+    if (table.entries == NULL) {
+      fprintf(stderr, "Perft table too big\n");
+      exit(1);
+    }
+    table.mask = num_of_entries - 1;
+  }
+  perft_table_t *t = (table.entries != NULL) ? &table : NULL;
+
+  sortable_move_t lst[MAX_NUM_MOVES];
+  uint64_t counts[MAX_NUM_MOVES];
+  int num_moves = generate_all(gme, lst, true);
+
+  for (int d = divide ? depth : 1; d <= depth; d++) {
+    cilk_for (int i = 0; i < num_moves; i++) {
+      counts[i] = perft_move(gme, get_move(lst[i]), d, t);
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < num_moves; i++) {
+      total += counts[i];
+      if (divide) {
+        char buf[MAX_CHARS_IN_MOVE];
+        move_to_str(get_move(lst[i]), buf, MAX_CHARS_IN_MOVE);
+        printf("%s %" PRIu64 "\n", buf, counts[i]);
+      }
+    }
+    printf("perft %2d %" PRIu64 "\n", d, total);
   }
+
+  free(table.entries);
 }
 
+
 // -----------------------------------------------------------------------------
 // Position display
 // -----------------------------------------------------------------------------
@@ -1114,7 +1401,7 @@ void display(position_t * p) {
   for (rnk_t r = BOARD_WIDTH - 1; r >= 0; --r) {
     printf("\ninfo %1d  ", r);
     for (fil_t f = 0; f < BOARD_WIDTH; ++f) {
-      square_t sq = square_table[f][r];
+      square_t sq = square_at(f, r);
 
       tbassert(ptype_of(p->board[sq]) != INVALID,
                "ptype_of(p->board[sq]): %d\n", ptype_of(p->board[sq]));
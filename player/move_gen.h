@@ -21,15 +21,21 @@
 // Board
 // -----------------------------------------------------------------------------
 
-// The board (which is 8x8 or 10x10) is centered in a 16x16 array, with the
-// excess height and width being used for sentinels.
-#define ARR_WIDTH 10
-#define ARR_SIZE (ARR_WIDTH * ARR_WIDTH)
-
-// Board is 8 x 8 or 10 x 10
+// Board is 8 x 8 or 10 x 10, chosen at compile time with -DBOARD_WIDTH=10.
+// Every geometry table is derived from BOARD_WIDTH.
+#ifndef BOARD_WIDTH
 #define BOARD_WIDTH 8
+#endif
+#if BOARD_WIDTH != 8 && BOARD_WIDTH != 10
+#error "BOARD_WIDTH must be 8 or 10"
+#endif
 #define BOARD_SIZE (BOARD_WIDTH * BOARD_WIDTH)
 
+// The board is centered in an array one square wider on every side, with the
+// excess height and width being used for sentinels.
+#define ARR_WIDTH (BOARD_WIDTH + 2)
+#define ARR_SIZE (ARR_WIDTH * ARR_WIDTH)
+
 typedef int square_t;
 typedef int rnk_t;
 typedef int fil_t;
@@ -37,6 +43,9 @@ typedef int fil_t;
 #define FIL_ORIGIN ((ARR_WIDTH - BOARD_WIDTH) / 2)
 #define RNK_ORIGIN ((ARR_WIDTH - BOARD_WIDTH) / 2)
 
+// Square of file f and rank r, see also square_of().
+#define square_at(f, r) (ARR_WIDTH * (FIL_ORIGIN + (f)) + RNK_ORIGIN + (r))
+
 #define FIL_SHIFT 4
 #define FIL_MASK 15
 #define RNK_SHIFT 0
@@ -48,7 +57,7 @@ typedef int fil_t;
 
 #define PIECE_SIZE 5  // Number of bits in (ptype, color, orientation)
 
-typedef int piece_t;
+typedef uint8_t piece_t;
 
 // -----------------------------------------------------------------------------
 // Piece types
@@ -127,26 +136,64 @@ typedef enum {
 
 // A single move can zap up to 13 pieces.
 typedef struct victims_t {
-  int zapped_count;
+  int8_t zapped_count;
   piece_t zapped[13];
 } victims_t;
 
-// Keep track of a player's pawns (max 8).
-#define MAX_PAWNS 7
-typedef struct pawns_t {
-  int pawns_count;
-  square_t squares[MAX_PAWNS];
-  // pawns_map[i][j] stores the pawn's index in squares
-  // pawns_map[i][j] corresponds to the pawn in (f=i, r=j)
-  // if pawns_map[i][j] = MAX_PAWNS, there is no pawn in (f=i, r=j)
-  uint8_t pawns_map[BOARD_WIDTH][BOARD_WIDTH];  
-} pawns_t;
-
 // returned by make move in illegal situation
 #define KO_ZAPPED -1
 // returned by make move in ko situation
 #define ILLEGAL_ZAPPED -1
 
+// -----------------------------------------------------------------------------
+// Bitboards
+// -----------------------------------------------------------------------------
+
+// One bit per board square.  Square (f, r) is bit f * BOARD_WIDTH + r, so each
+// file is a byte and laser beams along a file are shifts within that byte.
+// The transposed occupancy uses bit r * BOARD_WIDTH + f, which does the same
+// for ranks.
+//
+// A 10x10 board needs 100 bits, so bitboards are then 128 bits wide, and
+// bb_popcount() and bb_ctz() take two 64-bit halves.
+//
+// https://chessprogramming.wikispaces.com/Bitboards
+#if BOARD_SIZE <= 64
+typedef uint64_t bitboard_t;
+#define bb_popcount(b) __builtin_popcountll(b)
+#define bb_ctz(b) __builtin_ctzll(b)
+#else
+typedef unsigned __int128 bitboard_t;
+static inline int bb_popcount(bitboard_t b) {
+  return __builtin_popcountll((uint64_t) b) +
+         __builtin_popcountll((uint64_t) (b >> 64));
+}
+static inline int bb_ctz(bitboard_t b) {
+  return ((uint64_t) b != 0) ? __builtin_ctzll((uint64_t) b)
+                             : 64 + __builtin_ctzll((uint64_t) (b >> 64));
+}
+#endif
+
+#if BOARD_SIZE == 64
+#define BB_ALL (~(bitboard_t) 0)
+#else
+#define BB_ALL ((((bitboard_t) 1) << BOARD_SIZE) - 1)
+#endif
+#define BB_FILE_MASK ((((bitboard_t) 1) << BOARD_WIDTH) - 1)
+#define BB_RANK_MASK (BB_ALL / BB_FILE_MASK)  // bit 0 of every file
+
+#define bb_index(f, r) ((f) * BOARD_WIDTH + (r))
+#define bb_bit(f, r) (((bitboard_t) 1) << bb_index(f, r))
+#define file_bb(f) (BB_FILE_MASK << ((f) * BOARD_WIDTH))
+#define rank_bb(r) (BB_RANK_MASK << (r))
+#define square_bb(sq) bb_bit(fil_of(sq), rnk_of(sq))
+// square of bitboard index i
+#define bb_square(i) square_at((i) / BOARD_WIDTH, (i) % BOARD_WIDTH)
+
+// Pawns are only tracked by the bitboards.
+#define pawns_bb_of(p, c) ((p)->pawn_bb & (p)->color_bb[c])
+#define pawns_count_of(p, c) bb_popcount(pawns_bb_of(p, c))
+
 // -----------------------------------------------------------------------------
 // Position
 // -----------------------------------------------------------------------------
@@ -156,20 +203,96 @@ typedef struct pawns_t {
 // https://chessprogramming.wikispaces.com/Board+Representation
 // https://chessprogramming.wikispaces.com/Mailbox
 // https://chessprogramming.wikispaces.com/10x12+Board
-
+//
+// The bitboards mirror the board and are kept in sync with it by
+// toggle_piece_bb().
+
+// The lasers of both Kings in a position.  Entry c describes the laser of
+// color c and is current iff bit c of valid is set; laser_known() tells, and
+// trace_laser() fills it in.  Moves that do not touch a laser path leave that
+// laser as it was, so the child position inherits the parent's entry.
+typedef struct laser_state {
+  bitboard_t   path[2];          // squares passed, incl. the King and the piece hit
+  bitboard_t   pinned[2];        // pawns of the other color that reflect it
+  uint8_t      hit[2];           // square of the piece it would zap, or 0
+  uint8_t      valid;            // bit c set if entry c is current
+} laser_state_t;
+
+#define laser_known(p, c) ((((p)->laser.valid) >> (c)) & 1)
+
+// A one-bit-per-key Bloom filter over the positions that a position might
+// repeat: its ancestors back to the last move that zapped something, since a
+// zap can never be undone.  A key whose bit is clear is certainly not among
+// them, so most repetition checks need not walk the history.
+#define rep_bit(key) (((uint64_t) 1) << ((key) >> 58))
+
+// Running sums of the evaluation terms that depend only on where the Pawns
+// are, in ev_score_t units, so that eval() does not recompute them at every
+// node.  Making a move updates them for the Pawns it moves or zaps.
+typedef struct ev_terms {
+  int32_t      pawn[2];          // MATERIAL and PCENTRAL of each color's Pawns
+} ev_terms_t;
+
+// Every node copies its parent's position, so keep it small: one byte per
+// square, and nothing that the board or the bitboards already say, except the
+// laser state, which saves tracing the same lasers over and over, and the
+// eval sums.  Fields are ordered by size to avoid padding.
 typedef struct position {
-  piece_t      board[ARR_SIZE];
   struct position  *history;     // history of position
   uint64_t     key;              // hash key
+  uint64_t     rep_filter;       // keys of the positions since the last zap
+  bitboard_t   occupied;         // all pieces, one byte per file
+  bitboard_t   occupied_t;       // all pieces, one byte per rank (transposed)
+  bitboard_t   color_bb[2];      // pieces of each color
+  bitboard_t   pawn_bb;          // pawns of both colors
+  laser_state_t laser;           // lasers traced in this position so far
+  ev_terms_t   ev;               // running sums of the static eval terms
   int          ply;              // Even ply are White, odd are Black
   move_t       last_move;        // move that led to this position
   victims_t    victims;          // pieces destroyed by shooter
-  square_t     kloc[2];          // location of kings
-  pawns_t      ploc[2];          // locations of pawns
-  uint8_t ranks[8];
-  uint8_t files[8];
+  uint8_t      kloc[2];          // location of kings
+  piece_t      board[ARR_SIZE];
 } position_t;
 
+// -----------------------------------------------------------------------------
+// Undo stack
+// -----------------------------------------------------------------------------
+
+// What make_move_in_place() needs to remember to take a move back.
+typedef struct undo {
+  uint64_t     key;              // hash key before the move
+  uint64_t     rep_filter;       // repetition filter before the move
+  move_t       last_move;        // last move before the move
+  move_t       mv;               // the move itself
+  victims_t    victims;          // victims before the move
+  laser_state_t laser;           // laser state before the move
+  ev_terms_t   ev;               // eval sums before the move
+  uint8_t      zapped_sq[13];    // squares of the pieces the move zapped
+} undo_t;
+
+// One per strand of a search, holding the moves made in place on the current
+// line.  A strand that starts from a copy of the position of another strand
+// continues that strand's stack: the positions before the copy are the first
+// parent_top ones on parent.  The bottom stack has no parent; the positions
+// before its first one are p->history, which making moves in place leaves
+// alone.
+typedef struct undo_stack {
+  int          top;
+  struct undo_stack *parent;     // stack this one continues, or NULL
+  int          parent_top;       // top of parent when it was continued
+  undo_t       undo[MAX_PLY_IN_SEARCH];
+} undo_stack_t;
+
+// Walks the positions before a position made in place, latest first.
+typedef struct ancestor_walk {
+  undo_stack_t *stack;           // stack of the next one, NULL once past them
+  int          index;            // the next one is below index on stack
+  position_t   *pos;             // once past the stacks, the last one visited
+  uint64_t     key;              // the last position visited: its hash key,
+  move_t       last_move;        // the move that led to it,
+  bool         zapped;           // and whether that move zapped anything
+} ancestor_walk_t;
+
 // -----------------------------------------------------------------------------
 // Function prototypes
 // -----------------------------------------------------------------------------
@@ -181,9 +304,15 @@ void set_color(piece_t *x, color_t c);
 
 void set_ptype(piece_t *x, ptype_t pt);
 void set_ori(piece_t *x, int ori);
-void set_rank_and_file(position_t *p, square_t sq);
-void remove_rank_and_file(position_t *p, square_t sq);
-
+void toggle_piece_bb(position_t *p, square_t sq, piece_t x);
+bool bitboards_match_board(position_t *p);
+bool laser_state_is_current(position_t *p);
+
+void init_move_tables();
+void init_laser_tables();
+void trace_laser(position_t *p, color_t c);
+bitboard_t laser_path_bb(position_t *p, color_t c);
+bitboard_t generate_pinned_pawns(position_t *p, color_t c);
 square_t next_piece(position_t *p, square_t current, king_ori_t dir);
 
 #define ptype_of(x) ((ptype_t) (((x) >> PTYPE_SHIFT) & PTYPE_MASK))
@@ -194,19 +323,6 @@ square_t square_of(fil_t f, rnk_t r);
 void init_zob();
 uint64_t compute_zob_key(position_t *p);
 
-extern const int square_table[BOARD_WIDTH][BOARD_WIDTH];
-/*
-const int square_table[8][8] = { 
-  { 68, 69, 70, 71, 72, 73, 74, 75 },  
-  { 84, 85, 86, 87, 88, 89, 90, 91 },
-  { 100, 101, 102, 103, 104, 105, 106, 107 },
-  { 116, 117, 118, 119, 120, 121, 122, 123 },
-  { 132, 133, 134, 135, 136, 137, 138, 139 },
-  { 148, 149, 150, 151, 152, 153, 154, 155 },
-  { 164, 165, 166, 167, 168, 169, 170, 171 },
-  { 180, 181, 182, 183, 184, 185, 186, 187 }
-};
-*/
 
 // Finds file of square
 // #define fil_of(sq) ((((sq) >> FIL_SHIFT) & FIL_MASK) - FIL_ORIGIN)
@@ -234,15 +350,30 @@ extern const int beam[NUM_ORI];
 // reflect
 extern const int reflect[NUM_ORI][NUM_ORI];
 
+// the squares a King on sq can move to, plus sq itself, filled in by
+// init_move_tables()
+extern bitboard_t king_area[ARR_SIZE];
+#define king_area_bb(sq) (king_area[(sq)])
+
+// laser lookup tables, filled in by init_laser_tables()
+extern int8_t laser_turn[NUM_ORI][1 << PIECE_SIZE];
+extern bitboard_t laser_ray[NUM_ORI][ARR_SIZE];
+
 // FUNCTIONS
 move_t move_of(ptype_t typ, rot_t rot, square_t from_sq, square_t to_sq);
 void move_to_str(move_t mv, char *buf, size_t bufsize);
+move_t move_from_str(position_t *p, const char *mvstring);
 
 int generate_all(position_t *p, sortable_move_t *sortable_move_list,
                  bool strict);
-void do_perft(position_t *gme, int depth, int ply);
+int generate_captures(position_t *p, sortable_move_t *sortable_move_list);
+bool move_is_pseudo_legal(position_t *p, move_t mv);
+void do_perft(position_t *gme, int depth, bool divide);
 static inline void low_level_make_move(position_t *old, position_t *p, move_t mv);
 victims_t make_move(position_t *old, position_t *p, move_t mv);
+void init_undo_stack(undo_stack_t *stack, undo_stack_t *parent);
+victims_t make_move_in_place(position_t *p, move_t mv, undo_stack_t *stack);
+void unmake_move(position_t *p, undo_stack_t *stack);
 void display(position_t *p);
 
 inline victims_t KO() {
@@ -261,6 +392,34 @@ inline victims_t ILLEGAL() {
   );
 }
 
+// Starts a walk over the positions before p, which was made in place on
+// stack, or is not made in place at all if stack is NULL.
+static inline void init_ancestor_walk(ancestor_walk_t *w, position_t *p,
+                                      undo_stack_t *stack) {
+  w->stack = stack;
+  w->index = (stack != NULL) ? stack->top : 0;
+  w->pos = p;
+}
+
+// Steps w to the position before the one it visited last.
+static inline void ancestor_walk_next(ancestor_walk_t *w) {
+  while (w->stack != NULL && w->index == 0) {
+    w->index = w->stack->parent_top;
+    w->stack = w->stack->parent;
+  }
+  if (w->stack != NULL) {
+    undo_t *u = &(w->stack->undo[--w->index]);
+    w->key = u->key;
+    w->last_move = u->last_move;
+    w->zapped = u->victims.zapped_count > 0;
+  } else {
+    w->pos = w->pos->history;
+    w->key = w->pos->key;
+    w->last_move = w->pos->last_move;
+    w->zapped = w->pos->victims.zapped_count > 0;
+  }
+}
+
 int beam_of(int direction);
 int reflect_of(int beam_dir, int pawn_ori);
 int dir_of(int i);
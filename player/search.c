@@ -58,8 +58,11 @@ int LMR_R1;    // Look at this number of moves full width before reducing 1 ply
 int LMR_R2;    // After this number of moves reduce 2 ply
 
 int USE_NMM;       // Null move margin
+int LAZY_EVAL;     // Bound the stand pat score instead of computing it
+int EVAL_ORDER;    // Order moves without history by the eval of the child
 int TRACE_MOVES;   // Print moves
 int DETECT_DRAWS;  // Detect draws by repetition
+int MULTIPV;       // Number of root moves to report with exact scores
 
 // do not set more than 5 ply
 int FUT_DEPTH;     // set to zero for no futilty
@@ -87,7 +90,7 @@ static void initialize_pv_node(searchNode* node, int depth) {
   node->depth = depth;
   node->legal_move_count = 0;
   node->ply = node->parent->ply + 1;
-  node->fake_color_to_move = color_to_move_of(&(node->position));
+  node->fake_color_to_move = color_to_move_of(node->position);
   // point of view = 1 for white, -1 for black
   node->pov = 1 - node->fake_color_to_move * 2;
   node->quiescence = (depth <= 0);
@@ -125,22 +128,21 @@ static score_t searchPV(searchNode *node, int depth, uint64_t *node_count_serial
   move_t killer_c = killer[KMT(node->ply, 2)];
   move_t killer_d = killer[KMT(node->ply, 3)];
 
-  sortable_move_t move_list[MAX_NUM_MOVES];
-  int num_of_moves = get_sortable_move_list(node, move_list, hash_table_move);
+  // Hand out the hash move and killers first, and the rest in history order.
+  move_picker_t picker;
+  init_move_picker(&picker, node, hash_table_move);
   int num_moves_tried = 0;
 
-  // Incrementally sort the move list.
-  sort_incremental(move_list, num_of_moves, 0); 
-
   // Start searching moves.
-  for (int mv_index = 0; mv_index < num_of_moves; mv_index++) {
-    move_t mv = get_move(move_list[mv_index]);
+  for (move_t mv = next_move(&picker); mv != 0; mv = next_move(&picker)) {
+    int mv_index = picker.num_tried - 1;
 
     num_moves_tried++;
     (*node_count_serial)++;
 
     moveEvaluationResult result;
-    evaluateMove(node, mv, killer_a, killer_b, killer_c, killer_d,
+    evaluateMove(node, node->position, node->stack, mv, killer_a, killer_b,
+                 killer_c, killer_d,
         /* killer_e, killer_f, killer_g, killer_h, */
                  SEARCH_PV,
                  node_count_serial, &result, NULL);
@@ -164,8 +166,9 @@ static score_t searchPV(searchNode *node, int depth, uint64_t *node_count_serial
   }
 
   if (node->quiescence == false) {
-    update_best_move_history(&(node->position), node->best_move_index,
-                             move_list, num_moves_tried);
+    update_best_move_history(node->position, node->stack,
+                             node->best_move_index, picker.moves,
+                             num_moves_tried);
   }
 
   tbassert(abs(node->best_score) != -INF, "best_score = %d\n",
@@ -174,7 +177,7 @@ static score_t searchPV(searchNode *node, int depth, uint64_t *node_count_serial
   // Update the transposition table.
   //
   // Note: This function reads node->best_score, node->orig_alpha,
-  //   node->position.key, node->depth, node->ply, node->beta,
+  //   node->position->key, node->depth, node->ply, node->beta,
   //   node->alpha, node->subpv
   update_transposition_table(node);
 
@@ -189,29 +192,85 @@ static score_t searchPV(searchNode *node, int depth, uint64_t *node_count_serial
 // This handles scout search logic for the first level of the search tree
 // -----------------------------------------------------------------------------
 static void initialize_root_node(searchNode *node, score_t alpha, score_t beta, int depth,
-                            int ply, position_t* p) {
+                            int ply, position_t* p, undo_stack_t *stack) {
   node->type = SEARCH_ROOT;
   node->alpha = alpha;
   node->beta = beta;
   node->depth = depth;
   node->ply = ply;
-  node->position = *p;
-  node->fake_color_to_move = color_to_move_of(&(node->position));
+  node->position = p;
+  node->stack = stack;
+  node->fake_color_to_move = color_to_move_of(node->position);
   node->best_score = -INF;
   node->pov = 1 - node->fake_color_to_move * 2;  // pov = 1 for White, -1 for Black
   node->abort = false;
 }
 
+// Inserts score into the descending list of the best k root scores seen so
+// far in this iteration.  Returns the new number of entries.
+static int insert_multipv_score(score_t *best_scores, int count, int k,
+                                score_t score) {
+  if (count == k && score <= best_scores[k - 1]) {
+    return count;
+  }
+  int hole = (count < k) ? count++ : k - 1;
+  while (hole > 0 && score > best_scores[hole - 1]) {
+    best_scores[hole] = best_scores[hole - 1];
+    hole--;
+  }
+  best_scores[hole] = score;
+  return count;
+}
+
+// Reorders the root moves by the scores of the last completed iteration and
+// reports the best k of them as "info multipv" lines, unless OUT is NULL.
+// The lines give each root move, not its principal variation.
+static void report_multipv(sortable_move_t *move_list, score_t *move_scores,
+                           int num_of_moves, int depth,
+                           uint64_t node_count_serial, FILE *OUT) {
+  // stable insertion sort, so ties keep the order of the previous iteration
+  for (int j = 1; j < num_of_moves; j++) {
+    sortable_move_t insert_move = move_list[j];
+    score_t insert_score = move_scores[j];
+    int hole = j;
+    while (hole > 0 && insert_score > move_scores[hole - 1]) {
+      move_list[hole] = move_list[hole - 1];
+      move_scores[hole] = move_scores[hole - 1];
+      hole--;
+    }
+    move_list[hole] = insert_move;
+    move_scores[hole] = insert_score;
+  }
+
+  if (OUT == NULL) {
+    return;
+  }
+  double et = elapsed_time();
+  for (int i = 0; i < MULTIPV && i < num_of_moves; i++) {
+    if (move_scores[i] == -INF) {
+      break;  // the remaining moves are illegal
+    }
+    char mvbuf[MAX_CHARS_IN_MOVE];
+    move_to_str(get_move(move_list[i]), mvbuf, MAX_CHARS_IN_MOVE);
+    fprintf(OUT, "info multipv %d depth %d score cp %d time %d nodes %" PRIu64
+            " move %s\n", i + 1, depth, move_scores[i], (int) (et * 1000),
+            node_count_serial, mvbuf);
+  }
+}
+
 score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
                    int ply, move_t *optimal_move, uint64_t *node_count_serial,
-                   FILE *OUT) {
-  static int num_of_moves = 0;  // number of moves in list
-  // hopefully, more than we will need
-  static sortable_move_t move_list[MAX_NUM_MOVES];
+                   root_moves_t *root, FILE *OUT) {
+  sortable_move_t *move_list = root->move_list;
+  // scores of the root moves in this iteration, used to order the next one
+  // when reporting more than one principal variation
+  score_t *move_scores = root->move_scores;
+  int num_of_moves = root->num_of_moves;  // number of moves in list
 
   if (depth == 1) {
     // we are at depth 1; generate all possible moves
     num_of_moves = generate_all(p, move_list, false);
+    root->num_of_moves = num_of_moves;
  
     #ifdef DEBUG
       sort_incremental(move_list, num_of_moves, 0);
@@ -226,9 +285,16 @@ score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
     }
   }
 
+  // The moves are made in place on a copy of p.  The searches below copy it
+  // again only where they search moves in parallel.
+  position_t root_position = *p;
+  undo_stack_t stack;
+  init_undo_stack(&stack, NULL);
+
   searchNode rootNode;
   rootNode.parent = NULL;
-  initialize_root_node(&rootNode, alpha, beta, depth, ply, p);
+  initialize_root_node(&rootNode, alpha, beta, depth, ply, &root_position,
+                       &stack);
 
 
   assert(rootNode.best_score == alpha);  // initial conditions
@@ -236,11 +302,23 @@ score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
   searchNode next_node;
   next_node.optimal_move = 0;
   next_node.parent = &rootNode;
+  next_node.position = &root_position;
+  next_node.stack = &stack;
 
   score_t score;
 
-  for (int mv_index = 0; mv_index < num_of_moves; mv_index++) {
-    move_t mv = get_move(move_list[mv_index]);
+  // In MultiPV mode the root window is bounded below by the k-th best score
+  // instead of the best one, so that the best k moves all get exact scores.
+  score_t best_scores[MAX_NUM_MOVES];
+  int num_scored = 0;
+
+  // The root list keeps the order of the previous iteration.
+  move_picker_t picker;
+  init_move_picker_list(&picker, &rootNode, move_list, num_of_moves);
+
+  for (move_t mv = next_move(&picker); mv != 0; mv = next_move(&picker)) {
+    int mv_index = picker.num_tried - 1;
+    move_scores[mv_index] = -INF;
 
     if (TRACE_MOVES) {
       print_move_info(mv, ply);
@@ -249,9 +327,10 @@ score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
     (*node_count_serial)++;
 
     // make the move.
-    victims_t x = make_move(&(rootNode.position), &(next_node.position), mv);
+    victims_t x = make_move_in_place(&root_position, mv, &stack);
 
     if (is_KO(x)) {
+      unmake_move(&root_position, &stack);
       continue;  // not a legal move
     }
 
@@ -261,13 +340,13 @@ score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
       goto scored;
     }
 
-    if (is_repeated(&(next_node.position), rootNode.ply)) {
-      score = get_draw_score(&(next_node.position), rootNode.ply);
+    if (is_repeated(&root_position, &stack, rootNode.ply)) {
+      score = get_draw_score(rootNode.ply);
       next_node.optimal_move = 0;
       goto scored;
     }
 
-    if (mv_index == 0 || rootNode.depth == 1) {
+    if (num_scored < MULTIPV || rootNode.depth == 1) {
       // We guess that the first move is the principle variation
       score = -searchPV(&next_node, rootNode.depth-1, node_count_serial);
 
@@ -294,12 +373,19 @@ score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
     }
 
   scored:
+    unmake_move(&root_position, &stack);
+
     // only valid for the root node:
-    tbassert((score > rootNode.best_score) == (score > rootNode.alpha),
+    tbassert(MULTIPV > 1 ||
+             (score > rootNode.best_score) == (score > rootNode.alpha),
              "score = %d, best = %d, alpha = %d\n", score, rootNode.best_score, rootNode.alpha);
 
+    move_scores[mv_index] = score;
+    num_scored = insert_multipv_score(best_scores, num_scored, MULTIPV, score);
+
     if (score > rootNode.best_score) {
-      tbassert(score > rootNode.alpha, "score: %d, alpha: %d\n", score, rootNode.alpha);
+      tbassert(score > rootNode.alpha || MULTIPV > 1,
+               "score: %d, alpha: %d\n", score, rootNode.alpha);
 
       rootNode.best_score = score;
       //pv[0] = mv;
@@ -320,23 +406,28 @@ score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
       }
 
       uint64_t nps = 1000 * *node_count_serial / et;
-      fprintf(OUT, "info depth %d move_no %d time (microsec) %d nodes %" PRIu64
-              " nps %" PRIu64 "\n",
-              depth, mv_index + 1, (int) (et * 1000), *node_count_serial, nps);
-      fprintf(OUT, "info score cp %d best %s\n", score, optimal_move_buf);
-
-      // Slide this move to the front of the move list
-      for (int j = mv_index; j > 0; j--) {
-        move_list[j] = move_list[j - 1];
+      if (OUT != NULL) {
+        fprintf(OUT, "info depth %d move_no %d time (microsec) %d nodes %"
+                PRIu64 " nps %" PRIu64 "\n", depth, mv_index + 1,
+                (int) (et * 1000), *node_count_serial, nps);
+        fprintf(OUT, "info score cp %d best %s\n", score, optimal_move_buf);
+      }
+
+      // Slide this move to the front of the move list.  In MultiPV mode the
+      // whole list is reordered by score once the iteration completes.
+      if (MULTIPV == 1) {
+        for (int j = mv_index; j > 0; j--) {
+          move_list[j] = move_list[j - 1];
+        }
+        move_list[0] = mv;
       }
-      move_list[0] = mv;
     }
 
-    // Normal alpha-beta logic: if the current score is better than what the
+    // Normal alpha-beta logic: if the k-th best score is better than what the
     // maximizer has been able to get so far, take that new value.  Likewise,
     // score >= beta is the beta cutoff condition
-    if (score > rootNode.alpha) {
-      rootNode.alpha = score;
+    if (num_scored == MULTIPV && best_scores[MULTIPV - 1] > rootNode.alpha) {
+      rootNode.alpha = best_scores[MULTIPV - 1];
     }
     if (score >= rootNode.beta) {
       tbassert(0, "score: %d, beta: %d\n", score, rootNode.beta);
@@ -344,5 +435,10 @@ score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
     }
   }
 
+  if (MULTIPV > 1) {
+    report_multipv(move_list, move_scores, num_of_moves, depth,
+                   *node_count_serial, OUT);
+  }
+
   return rootNode.best_score;
 }
@@ -42,11 +42,21 @@ typedef struct searchNode {
   score_t best_score;
   move_t optimal_move;
   int best_move_index;
-  position_t position;
+  position_t *position;          // made in place on stack, shared with the
+  undo_stack_t *stack;           // nodes below on the same strand
   //move_t subpv[MAX_PLY_IN_SEARCH];
 } searchNode;
 
 
+// The root moves of a search, in the order of the last iteration of
+// iterative deepening, which orders the next one.  One per search that runs
+// at the same time as others.
+typedef struct root_moves {
+  int num_of_moves;
+  sortable_move_t move_list[MAX_NUM_MOVES];
+  score_t move_scores[MAX_NUM_MOVES];
+} root_moves_t;
+
 void init_tics();
 void init_abort_timer(double goal_time);
 double elapsed_time();
@@ -56,7 +66,7 @@ void init_best_move_history();
 move_t get_move(sortable_move_t sortable_mv);
 score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
                    int ply, move_t *optimal_move, uint64_t *node_count_serial,
-                   FILE *OUT);
+                   root_moves_t *root, FILE *OUT);
 
 
 #endif  // SEARCH_H
@@ -4,6 +4,11 @@
 
 #define SCORE_THRESHOLD 1
 
+// Added to the sort key of the counter move, which puts it ahead of every
+// move ordered by history alone.  That key is the sum of a best move history
+// and a follow-up history entry, so it stays below 2 * HISTORY_LIMIT.
+#define COUNTER_MOVE_BONUS (2 * HISTORY_LIMIT)
+
 // tic counter for how often we should check for abort
 static int     tics = 0;
 static double  sstart;    // start time of a search in milliseconds
@@ -81,57 +86,48 @@ move_t get_move(sortable_move_t sortable_mv) {
   return (move_t) (sortable_mv & MOVE_MASK);
 }
 
-static score_t get_draw_score(position_t *p, int ply) {
-  position_t *x = p->history;
-  uint64_t cur = p->key;
-  score_t score;
+// Score of a repeated position found at ply.
+static score_t get_draw_score(int ply) {
+  if (ply & 1) {
+    return -DRAW;
+  }
+  return DRAW;
+}
+
+// Walks the positions before p back to the last zap, looking for p's key.  p
+// was made in place on stack.
+static bool key_in_history(position_t *p, undo_stack_t *stack) {
+  ancestor_walk_t w;
+  init_ancestor_walk(&w, p, stack);
+
   while (true) {
-    if (!zero_victims(x->victims)) {
+    ancestor_walk_next(&w);
+    if (w.zapped) {
       break;  // cannot be a repetition
     }
-    x = x->history;
-    if (!zero_victims(x->victims)) {
+    ancestor_walk_next(&w);
+    if (w.zapped) {
       break;  // cannot be a repetition
     }
-    if (x->key == cur) {  // is a repetition
-      if (ply & 1) {
-        score = -DRAW;
-      } else {
-        score = DRAW;
-      }
-      return score;
+    if (w.key == p->key) {  // is a repetition
+      return true;
     }
-    x = x->history;
   }
-  assert(false);  // This should not occur.
-  return (score_t) 0;
+  return false;
 }
 
-
-
 // Detect move repetition
-static bool is_repeated(position_t *p, int ply) {
+static bool is_repeated(position_t *p, undo_stack_t *stack, int ply) {
   if (!DETECT_DRAWS) {
     return false;  // no draw detected
   }
 
-  position_t *x = p->history;
-  uint64_t cur = p->key;
-
-  while (true) {
-    if (!zero_victims(x->victims)) {
-      break;  // cannot be a repetition
-    }
-    x = x->history;
-    if (!zero_victims(x->victims)) {
-      break;  // cannot be a repetition
-    }
-    if (x->key == cur) {  // is a repetition
-      return true;
-    }
-    x = x->history;
+  if (!(p->rep_filter & rep_bit(p->key))) {
+    // no earlier position since the last zap has this key
+    tbassert(!key_in_history(p, stack), "repetition filter missed a key\n");
+    return false;
   }
-  return false;
+  return key_in_history(p, stack);
 }
 
 
@@ -198,7 +194,7 @@ leafEvalResult evaluate_as_leaf(searchNode *node, searchType_t type) {
   // get transposition table record if available.
   //
   // https://chessprogramming.wikispaces.com/Transposition+Table
-  ttRec_t *rec = tt_hashtable_get(node->position.key);
+  ttRec_t *rec = tt_hashtable_get(node->position->key);
   if (rec) {
     if (type == SEARCH_SCOUT && tt_is_usable(rec, node->depth, node->beta)) {
       result.type = MOVE_EVALUATED;
@@ -211,8 +207,12 @@ leafEvalResult evaluate_as_leaf(searchNode *node, searchType_t type) {
   // stand pat (having-the-move) bonus
   //
   // https://chessprogramming.wikispaces.com/Quiescence+Search#StandPat
-  score_t sps = eval(&(node->position), false) + HMB;
   bool quiescence = (node->depth <= 0);  // are we in quiescence?
+  // in quiescence the stand pat score only matters relative to the window
+  score_t sps = ((quiescence && LAZY_EVAL) ?
+                 eval_bounded(node->position, node->alpha - HMB,
+                              node->beta - HMB) :
+                 eval(node->position, false)) + HMB;
   result.should_enter_quiescence = quiescence;
   if (quiescence) {
     result.score = sps;
@@ -251,7 +251,12 @@ leafEvalResult evaluate_as_leaf(searchNode *node, searchType_t type) {
   return result;
 }
 
-void evaluateMove(searchNode *node, move_t mv, move_t killer_a,
+// Searches the move mv from node, making it in place on p, which is the
+// position of node, and taking it back before returning.  p is
+// node->position, or a copy of it for a strand of its own with stack
+// continuing node->stack.
+void evaluateMove(searchNode *node, position_t *p, undo_stack_t *stack,
+                                  move_t mv, move_t killer_a,
                                   move_t killer_b, move_t killer_c,
                                   move_t killer_d, searchType_t type,
                                   uint64_t *node_count_serial,
@@ -263,17 +268,18 @@ void evaluateMove(searchNode *node, move_t mv, move_t killer_a,
   //result->next_node.subpv[0] = 0;
   result->next_node.optimal_move = 0;
   result->next_node.parent = node;
+  result->next_node.position = p;
+  result->next_node.stack = stack;
 
   // Make the move, and get any victim pieces.
-  victims_t victims = make_move(&(node->position), &(result->next_node.position),
-                                mv);
+  victims_t victims = make_move_in_place(p, mv, stack);
 
   // Check whether this move changes the board state (moves that don't are
   // illegal).
   if (is_KO(victims)) {
     result->type = MOVE_ILLEGAL;
     if ( mutex ) { __sync_bool_compare_and_swap(mutex, 1, 0); }
-    return;
+    goto unmake;
   }
 
   // Check whether the game is over.
@@ -282,22 +288,22 @@ void evaluateMove(searchNode *node, move_t mv, move_t killer_a,
     result->type = MOVE_GAMEOVER;
     result->score = get_game_over_score(victims, node->pov, node->ply);
     if ( mutex ) { __sync_bool_compare_and_swap(mutex, 1, 0); }
-    return;
+    goto unmake;
   }
 
   // Ignore noncapture moves when in quiescence.
   if (zero_victims(victims) && node->quiescence) {
     result->type = MOVE_IGNORE;
     if ( mutex ) { __sync_bool_compare_and_swap(mutex, 1, 0); }
-    return;
+    goto unmake;
   }
 
   // Check whether the board state has been repeated, this results in a draw.
-  if (is_repeated(&(result->next_node.position), node->ply)) {
+  if (is_repeated(p, stack, node->ply)) {
     result->type = MOVE_GAMEOVER;
-    result->score = get_draw_score(&(result->next_node.position), node->ply);
+    result->score = get_draw_score(node->ply);
     if ( mutex ) { __sync_bool_compare_and_swap(mutex, 1, 0); }
-    return;
+    goto unmake;
   }
 
   // Check whether we blundered (caused only our own pieces to be zapped).
@@ -315,7 +321,7 @@ void evaluateMove(searchNode *node, move_t mv, move_t killer_a,
   if (node->quiescence && blunder) {
     result->type = MOVE_IGNORE;
     if (mutex) { __sync_bool_compare_and_swap(mutex, 1, 0); }
-    return;
+    goto unmake;
   }
 
   // Extend the search-depth by 1 if we captured piece, since that means the
@@ -357,7 +363,7 @@ void evaluateMove(searchNode *node, move_t mv, move_t killer_a,
                                             node_count_serial);
     if (reduced_depth_score < node->beta) {
       result->score = reduced_depth_score;
-      return;
+      goto unmake;
     }
     search_depth += next_reduction;
   }
@@ -366,7 +372,7 @@ void evaluateMove(searchNode *node, move_t mv, move_t killer_a,
   if (abortf) {
     result->score = 0;
     result->type = MOVE_IGNORE;
-    return;
+    goto unmake;
   }
 
   // further searching  
@@ -384,7 +390,8 @@ void evaluateMove(searchNode *node, move_t mv, move_t killer_a,
       }
     }
   }
-  return;
+unmake:
+  unmake_move(p, stack);
 }
 
 
@@ -402,28 +409,6 @@ void sort_incremental(sortable_move_t *move_list, int num_of_moves, int mv_index
   }
 }
 
-// put the best m moves in move_list in the front of move_list and in decreasing order  
-void sort_best_moves(sortable_move_t *move_list, int num_of_moves, int m) {
-  tbassert(m <= num_of_moves, "Error, m is more than num_of_moves");
-  sortable_move_t temp, best_move;
-  int best_move_index;
-  for (int i = 0; i < m; i++) {
-    best_move_index = i;
-    best_move = move_list[i];
-    for (int j = i + 1; j < num_of_moves; j++) {
-      if (move_list[j] > best_move) {
-        best_move_index = j;
-        best_move = move_list[j];
-      }
-    }
-    if (best_move_index > i) {
-      temp = move_list[i];
-      move_list[i] = best_move;
-      move_list[best_move_index] = temp;
-    }
-  }
-}
-
 // Returns true if a cutoff was triggered, false otherwise.
 bool search_process_score(searchNode *node, move_t mv, int mv_index,
                                 moveEvaluationResult *result, searchType_t type) {
@@ -454,6 +439,9 @@ bool search_process_score(searchNode *node, move_t mv, int mv_index,
         killer[KMT(node->ply, 1)] = killer[KMT(node->ply, 0)];
         killer[KMT(node->ply, 0)] = mv;
       }
+      if (ENABLE_TABLES) {
+        counter_move[counter_move_index(node->position)] = mv;
+      }
       return true;
     }
   }
@@ -472,108 +460,224 @@ bool should_abort_check() {
   return false;
 }
 
-// Obtain a sorted move list.
+// -----------------------------------------------------------------------------
+// Staged move picker
 //
-// https://chessprogramming.wikispaces.com/Move+Ordering
-static int get_sortable_move_list(searchNode *node, sortable_move_t * move_list,
-                         int hash_table_move) {
-  // number of moves in list
-  int num_of_moves = generate_all(&(node->position), move_list, false);
-  int num_of_good_moves = num_of_moves;
+// Most cut nodes are refuted by the hash move or a killer, so those are tried
+// first, after a cheap validity check against the position, and the full move
+// list is only generated and scored by history once they are exhausted.  The
+// counter move to the opponent's last move is ordered first among the rest.
+// With EVAL_ORDER, the moves without a history score come last, ordered by
+// eval_children() once they are reached.
+//
+// https://chessprogramming.wikispaces.com/Move+Generation#Staged
+// -----------------------------------------------------------------------------
 
-  color_t fake_color_to_move = color_to_move_of(&(node->position));
-  int critical_moves = 0;
+typedef enum {
+  PICK_HASH_MOVE,
+  PICK_KILLERS,
+  PICK_GENERATE,
+  PICK_REMAINING
+} pick_stage_t;
+
+typedef struct move_picker {
+  searchNode *node;
+  pick_stage_t stage;
+  move_t hash_move;
+  int killer_index;     // next killer slot to try
+  int num_critical;     // hash move and killers, at the front of moves
+  int num_of_moves;     // moves in the list so far
+  int num_good_moves;   // moves before this index have a nonzero history
+  int num_tried;        // moves handed out so far, always a prefix of moves
+  bool order_rest;      // order the moves without history by eval_children
+  sortable_move_t moves[MAX_NUM_MOVES];
+} move_picker_t;
+
+static void init_move_picker(move_picker_t *mp, searchNode *node,
+                             move_t hash_move) {
+  mp->node = node;
+  mp->stage = PICK_HASH_MOVE;
+  mp->hash_move = hash_move;
+  mp->killer_index = 0;
+  mp->num_critical = 0;
+  mp->num_of_moves = 0;
+  mp->num_good_moves = 0;
+  mp->num_tried = 0;
+  mp->order_rest = false;
+}
 
-  move_t killer_a = killer[KMT(node->ply, 0)];
-  move_t killer_b = killer[KMT(node->ply, 1)];
-  move_t killer_c = killer[KMT(node->ply, 2)];
-  move_t killer_d = killer[KMT(node->ply, 3)];
-  sortable_move_t temp;
-  // sort special moves to the front
-  for (int mv_index = 0; mv_index < num_of_good_moves; mv_index++) {
-    move_t mv = get_move(move_list[mv_index]);
-    if (mv == hash_table_move) {
-      set_sort_key(&move_list[mv_index], SORT_MASK);
-      temp = move_list[critical_moves];
-      move_list[critical_moves] = move_list[mv_index];
-      move_list[mv_index] = temp;
-      critical_moves++;
-    } else if (mv == killer_a) {
-      set_sort_key(&move_list[mv_index], SORT_MASK - 1);
-      temp = move_list[critical_moves];
-      move_list[critical_moves] = move_list[mv_index];
-      move_list[mv_index] = temp;
-      critical_moves++;
-    } else if (mv == killer_b) {
-      set_sort_key(&move_list[mv_index], SORT_MASK - 2);
-      temp = move_list[critical_moves];
-      move_list[critical_moves] = move_list[mv_index];
-      move_list[mv_index] = temp;
-      critical_moves++;
-    } else if (mv == killer_c) {
-      set_sort_key(&move_list[mv_index], SORT_MASK - 3);
-      temp = move_list[critical_moves];
-      move_list[critical_moves] = move_list[mv_index];
-      move_list[mv_index] = temp;
-      critical_moves++;
-    }  else if (mv == killer_d) {
-      set_sort_key(&move_list[mv_index], SORT_MASK - 4);
-      temp = move_list[critical_moves];
-      move_list[critical_moves] = move_list[mv_index];
-      move_list[mv_index] = temp;
-      critical_moves++; 
-    } /*else if (mv == killer_e) {
-      set_sort_key(&move_list[mv_index], SORT_MASK - 5);
-      temp = move_list[critical_moves];
-      move_list[critical_moves] = move_list[mv_index];
-      move_list[mv_index] = temp;
-      critical_moves++;
-    } else if (mv == killer_f) {
-      set_sort_key(&move_list[mv_index], SORT_MASK - 6);
-      temp = move_list[critical_moves];
-      move_list[critical_moves] = move_list[mv_index];
-      move_list[mv_index] = temp;
-      critical_moves++;
-    } else if (mv == killer_g) {
-      set_sort_key(&move_list[mv_index], SORT_MASK - 7);
-      temp = move_list[critical_moves];
-      move_list[critical_moves] = move_list[mv_index];
-      move_list[mv_index] = temp;
-      critical_moves++;
-    } else if (mv == killer_h) {
-      set_sort_key(&move_list[mv_index], SORT_MASK - 8);
-      temp = move_list[critical_moves];
-      move_list[critical_moves] = move_list[mv_index];
-      move_list[mv_index] = temp;
-      critical_moves++; 
-    } */
-    else {
-      ptype_t  pce = ptype_mv_of(mv);
-      rot_t    ro  = rot_of(mv);   // rotation
-      square_t fs  = from_square(mv);
-      int      ot  = ORI_MASK & (ori_of(node->position.board[fs]) + ro);
-      square_t ts  = to_square(mv);
-
-      int score = best_move_history[BMH(fake_color_to_move, pce, ts, ot)];
-
-      #ifndef DEBUG
-      if (score == 0) {
-        num_of_good_moves--;
-        sortable_move_t  temp2 = move_list[mv_index];
-        move_list[mv_index] = move_list[num_of_good_moves];
-        move_list[num_of_good_moves] = temp2;
-        mv_index--;
-        continue;
+static bool picker_is_critical(move_picker_t *mp, move_t mv) {
+  for (int i = 0; i < mp->num_critical; i++) {
+    if (get_move(mp->moves[i]) == mv) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Generates the moves that have not been tried as hash move or killer, and
+// scores them by history.  Moves without a history score are kept unsorted at
+// the back of the list; the others are ordered lazily by next_move.
+static void picker_generate(move_picker_t *mp) {
+  position_t *p = mp->node->position;
+  sortable_move_t *move_list = mp->moves + mp->num_critical;
+  // quiescence nodes ignore moves that do not zap anything
+  int num_of_moves = mp->node->quiescence ?
+                     generate_captures(p, move_list) :
+                     generate_all(p, move_list, false);
+  color_t fake_color_to_move = color_to_move_of(p);
+  move_t counter = counter_move[counter_move_index(p)];
+  move_t prev = own_previous_move(p, mp->node->stack);
+
+  // drop the moves that were already handed out
+  if (mp->num_critical > 0) {
+    int kept = 0;
+    for (int i = 0; i < num_of_moves; i++) {
+      if (!picker_is_critical(mp, get_move(move_list[i]))) {
+        move_list[kept++] = move_list[i];
       }
-      #endif
-      set_sort_key(&move_list[mv_index], score);
     }
+    num_of_moves = kept;
+  }
+
+  // debug builds sort the moves without history too, unless they are to be
+  // ordered by eval_children
+  bool order_rest = EVAL_ORDER && !mp->node->quiescence;
+  int num_of_good_moves = num_of_moves;
+  for (int mv_index = 0; mv_index < num_of_good_moves; mv_index++) {
+    move_t   mv  = get_move(move_list[mv_index]);
+    ptype_t  pce = ptype_mv_of(mv);
+    rot_t    ro  = rot_of(mv);   // rotation
+    square_t fs  = from_square(mv);
+    int      ot  = ORI_MASK & (ori_of(p->board[fs]) + ro);
+    square_t ts  = to_square(mv);
+
+    int score = best_move_history[BMH(fake_color_to_move, pce, ts, ot)] +
+                follow_up_history[follow_up_index(p, prev, ts, ot)];
+    if (mv == counter) {
+      score += COUNTER_MOVE_BONUS;
+    }
+
+    #ifdef DEBUG
+    if (score == 0 && order_rest) {
+    #else
+    if (score == 0) {
+    #endif
+      num_of_good_moves--;
+      sortable_move_t temp = move_list[mv_index];
+      move_list[mv_index] = move_list[num_of_good_moves];
+      move_list[num_of_good_moves] = temp;
+      mv_index--;
+      continue;
+    }
+    set_sort_key(&move_list[mv_index], score);
   }
-  sort_incremental(move_list, critical_moves, critical_moves);
-  move_list[num_of_moves] = critical_moves;
-  move_list[num_of_moves + 1] = num_of_good_moves;
 
-  return num_of_moves;
+  mp->num_of_moves = mp->num_critical + num_of_moves;
+  mp->num_good_moves = mp->num_critical + num_of_good_moves;
+  mp->order_rest = order_rest && num_of_good_moves < num_of_moves;
+  mp->stage = PICK_REMAINING;
 }
 
+// Orders the moves without a history score, once the others have all been
+// handed out, by the static score of the position each one leads to.
+static void picker_order_rest(move_picker_t *mp) {
+  ev_score_t scores[MAX_NUM_MOVES];
+  sortable_move_t *rest = mp->moves + mp->num_good_moves;
+  int num_rest = mp->num_of_moves - mp->num_good_moves;
+  eval_children(mp->node->position, rest, num_rest, scores);
+  for (int i = 0; i < num_rest; i++) {
+    // flipping the sign bit keeps the order of the scores as sort keys
+    set_sort_key(&rest[i], (sort_key_t) scores[i] ^ (1U << 31));
+  }
+  mp->num_good_moves = mp->num_of_moves;
+  mp->order_rest = false;
+}
 
+// Returns the next hash move or killer, or 0 once those are exhausted.
+static move_t next_critical_move(move_picker_t *mp) {
+  if (mp->stage == PICK_HASH_MOVE) {
+    mp->stage = PICK_KILLERS;
+    if (move_is_pseudo_legal(mp->node->position, mp->hash_move)) {
+      mp->moves[mp->num_critical++] = mp->hash_move;
+      mp->num_of_moves = mp->num_critical;
+      return get_move(mp->moves[mp->num_tried++]);
+    }
+  }
+  while (mp->stage == PICK_KILLERS && mp->killer_index < KMT_SIZE) {
+    move_t mv = killer[KMT(mp->node->ply, mp->killer_index)];
+    mp->killer_index++;
+    if (!picker_is_critical(mp, mv) &&
+        move_is_pseudo_legal(mp->node->position, mv)) {
+      mp->moves[mp->num_critical++] = mv;
+      mp->num_of_moves = mp->num_critical;
+      return get_move(mp->moves[mp->num_tried++]);
+    }
+  }
+  if (mp->stage == PICK_KILLERS) {
+    mp->stage = PICK_GENERATE;
+  }
+  return 0;
+}
+
+// Hands out the moves of an already ordered list, e.g. the root move list, in
+// the given order.
+static void init_move_picker_list(move_picker_t *mp, searchNode *node,
+                                  sortable_move_t *move_list,
+                                  int num_of_moves) {
+  init_move_picker(mp, node, 0);
+  memcpy(mp->moves, move_list, sizeof(sortable_move_t) * num_of_moves);
+  mp->num_of_moves = num_of_moves;
+  mp->stage = PICK_REMAINING;
+}
+
+// Swaps the best scored move that has not been tried yet to the front of the
+// untried range.  Most nodes cut off after a few moves, so selecting on demand
+// is cheaper than sorting the whole list.  Sort keys carry the move in their
+// low bits and are therefore distinct, so this yields the same order as a
+// full sort.
+static void picker_select_best(move_picker_t *mp) {
+  int best = mp->num_tried;
+  for (int i = best + 1; i < mp->num_good_moves; i++) {
+    if (mp->moves[i] > mp->moves[best]) {
+      best = i;
+    }
+  }
+  sortable_move_t temp = mp->moves[mp->num_tried];
+  mp->moves[mp->num_tried] = mp->moves[best];
+  mp->moves[best] = temp;
+}
+
+// Returns the next move to search, or 0 once all moves have been handed out.
+static move_t next_move(move_picker_t *mp) {
+  if (mp->stage < PICK_GENERATE) {
+    move_t mv = next_critical_move(mp);
+    if (mv != 0) {
+      return mv;
+    }
+  }
+  if (mp->stage == PICK_GENERATE) {
+    picker_generate(mp);
+  }
+  if (mp->num_tried >= mp->num_of_moves) {
+    return 0;
+  }
+  if (mp->order_rest && mp->num_tried == mp->num_good_moves) {
+    picker_order_rest(mp);
+  }
+  if (mp->num_tried < mp->num_good_moves) {
+    picker_select_best(mp);
+  }
+  return get_move(mp->moves[mp->num_tried++]);
+}
+
+// Number of moves that next_move has yet to hand out.  Must only be called
+// once the hash move and killers have been handed out; generates the full move
+// list if that has not happened yet.
+static int picker_num_remaining(move_picker_t *mp) {
+  tbassert(mp->stage >= PICK_GENERATE, "stage: %d\n", mp->stage);
+  if (mp->stage == PICK_GENERATE) {
+    picker_generate(mp);
+  }
+  return mp->num_of_moves - mp->num_tried;
+}
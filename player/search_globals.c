@@ -24,15 +24,68 @@ static __thread move_t killer __KMT_dim__;  // up to 4 killers
 
 static int best_move_history __BMH_dim__;
 
+// Counter move table, holding the last move that refuted a given move of the
+// opponent
+//
+// https://chessprogramming.wikispaces.com/Countermove+Heuristic
+//
+// FORMAT: counter_move[color_t][square_t][rot_t], where the square and
+// rotation are those of the opponent's last move
+#define __CMT_dim__ [2*ARR_SIZE*NUM_ORI]  // NOLINT(whitespace/braces)
+#define CMT(color, square, rot) \
+    (color * ARR_SIZE * NUM_ORI + square * NUM_ORI + rot)
+
+static move_t counter_move __CMT_dim__;
+
+// Follow-up history table, a best move history that also depends on the
+// destination of our own previous move
+//
+// FORMAT: follow_up_history[color_t][square_t][square_t][orientation]
+#define __FUH_dim__ [2*ARR_SIZE*ARR_SIZE*NUM_ORI]  // NOLINT(whitespace/braces)
+#define FUH(color, prev_square, square, ori)                             \
+    (color * ARR_SIZE * ARR_SIZE * NUM_ORI + prev_square * ARR_SIZE * NUM_ORI + \
+     square * NUM_ORI + ori)
+
+static int follow_up_history __FUH_dim__;
+
+// Both history tables decay towards 100800, so their entries stay below this.
+#define HISTORY_LIMIT 102000
+
 void init_best_move_history() {
   memset(best_move_history, 0, sizeof(best_move_history));
+  memset(counter_move, 0, sizeof(counter_move));
+  memset(follow_up_history, 0, sizeof(follow_up_history));
+}
+
+// Index into counter_move for the position after the opponent's last move.
+static inline int counter_move_index(position_t *p) {
+  move_t last = p->last_move;
+  return CMT(color_to_move_of(p), to_square(last), rot_of(last));
+}
+
+// Our own previous move, two plies back from p, which was made in place on
+// stack.
+static inline move_t own_previous_move(position_t *p, undo_stack_t *stack) {
+  ancestor_walk_t w;
+  init_ancestor_walk(&w, p, stack);
+  ancestor_walk_next(&w);
+  return w.last_move;
+}
+
+// Index into follow_up_history for a move to square ts leaving the piece with
+// orientation ot, given our own previous move prev two plies back.
+static inline int follow_up_index(position_t *p, move_t prev, square_t ts,
+                                  int ot) {
+  return FUH(color_to_move_of(p), to_square(prev), ts, ot);
 }
 
-static void update_best_move_history(position_t *p, int index_of_best,
+static void update_best_move_history(position_t *p, undo_stack_t *stack,
+                                     int index_of_best,
                                      sortable_move_t* lst, int count) {
   tbassert(ENABLE_TABLES, "Tables weren't enabled.\n");
 
   int color_to_move = color_to_move_of(p);
+  move_t prev = own_previous_move(p, stack);
 
   for (int i = 0; i < count; i++) {
     move_t   mv  = get_move(lst[i]);
@@ -43,38 +96,43 @@ static void update_best_move_history(position_t *p, int index_of_best,
     square_t ts  = to_square(mv);
 
     int  s = best_move_history[BMH(color_to_move, pce, ts, ot)];
+    int  f = follow_up_history[follow_up_index(p, prev, ts, ot)];
 
     if (index_of_best == i) {
       s = s + 11200;  // number will never exceed 1017
+      f = f + 11200;
     }
     s = s * 0.90;  // decay score over time
+    f = f * 0.90;
 
-    tbassert(s < 102000, "s = %d\n", s);  // or else sorting will fail
+    tbassert(s < HISTORY_LIMIT, "s = %d\n", s);  // or else sorting will fail
+    tbassert(f < HISTORY_LIMIT, "f = %d\n", f);
 
     best_move_history[BMH(color_to_move, pce, ts, ot)] = s;
+    follow_up_history[follow_up_index(p, prev, ts, ot)] = f;
   }
 }
 
 static void update_transposition_table(searchNode* node) {
   if (node->type == SEARCH_SCOUT) {
     if (node->best_score < node->beta) {
-      tt_hashtable_put(node->position.key, node->depth,
+      tt_hashtable_put(node->position->key, node->depth,
                        tt_adjust_score_for_hashtable(node->best_score, node->ply),
                        UPPER, 0);
     } else {
-      tt_hashtable_put(node->position.key, node->depth,
+      tt_hashtable_put(node->position->key, node->depth,
                        tt_adjust_score_for_hashtable(node->best_score, node->ply),
                        LOWER, node->optimal_move);
     }
   } else if (node->type == SEARCH_PV) {
     if (node->best_score <= node->orig_alpha) {
-      tt_hashtable_put(node->position.key, node->depth,
+      tt_hashtable_put(node->position->key, node->depth,
           tt_adjust_score_for_hashtable(node->best_score, node->ply), UPPER, 0);
     } else if (node->best_score >= node->beta) {
-      tt_hashtable_put(node->position.key, node->depth,
+      tt_hashtable_put(node->position->key, node->depth,
           tt_adjust_score_for_hashtable(node->best_score, node->ply), LOWER, node->optimal_move);
     } else {
-      tt_hashtable_put(node->position.key, node->depth,
+      tt_hashtable_put(node->position->key, node->depth,
           tt_adjust_score_for_hashtable(node->best_score, node->ply), EXACT, node->optimal_move);
     }
   }
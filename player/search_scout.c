@@ -47,7 +47,7 @@ static void initialize_scout_node(searchNode * node, int depth) {
   node->ply = node->parent->ply + 1;
   node->optimal_move = 0;
   node->legal_move_count = 0;
-  node->fake_color_to_move = color_to_move_of(&(node->position));
+  node->fake_color_to_move = color_to_move_of(node->position);
   // point of view = 1 for white, -1 for black
   node->pov = 1 - node->fake_color_to_move * 2;
   node->best_move_index = 0;    // index of best move found
@@ -82,33 +82,31 @@ static score_t scout_search(searchNode * node, int depth,
   move_t killer_c = killer[KMT(node->ply, 2)];
   move_t killer_d = killer[KMT(node->ply, 3)];
 
-  // Store the sorted move list on the stack.
-  // MAX_NUM_MOVES is all that we need.
-  sortable_move_t move_list[MAX_NUM_MOVES];
-
-  // Obtain the sorted move list.
-  int num_of_moves = get_sortable_move_list(node, move_list, hash_table_move);
-  int good_moves = move_list[num_of_moves + 1];
-  int number_of_moves_evaluated = 0;
+  // Hand out the hash move and killers first, and generate the rest of the
+  // moves only if none of those produces a cutoff.
+  move_picker_t picker;
+  init_move_picker(&picker, node, hash_table_move);
 
   // A simple mutex. See simple_mutex.h for implementation details.
   simple_mutex_t node_mutex;
   init_simple_mutex(&node_mutex);
 
   bool cutoff = false;
-  // TODO: experiment with sorting at each iteration vs all at the beginning
-  // Sort the move list.
-  int critical_moves = move_list[num_of_moves];
-  if (critical_moves == 0) {
-    critical_moves++;
-    sort_best_moves(move_list, num_of_moves, critical_moves);
-  }
-  // older siblings first in serial
-  for (int mv_index = 0; mv_index < critical_moves; mv_index++) {
+  // older siblings first in serial: the hash move and the killers, or the
+  // best ordinary move if there are none
+  while (true) {
+    move_t mv = next_critical_move(&picker);
+    if (mv == 0) {
+      if (picker.num_tried > 0) {
+        break;
+      }
+      mv = next_move(&picker);
+      if (mv == 0) {
+        break;
+      }
+    }
+    int local_index = picker.num_tried - 1;
 
-    // Get the next move from the move list.
-    int local_index = number_of_moves_evaluated++;
-    move_t mv = get_move(move_list[local_index]);
     if (TRACE_MOVES) {
       print_move_info(mv, node->ply);
     }
@@ -117,8 +115,9 @@ static score_t scout_search(searchNode * node, int depth,
 
     // serial evaluation
     moveEvaluationResult result;
-    evaluateMove(node, mv, killer_a, killer_b, killer_c, killer_d,
-                 SEARCH_SCOUT, node_count_serial, &result, NULL);
+    evaluateMove(node, node->position, node->stack, mv, killer_a, killer_b,
+                 killer_c, killer_d, SEARCH_SCOUT, node_count_serial, &result,
+                 NULL);
     if (result.type == MOVE_ILLEGAL || result.type == MOVE_IGNORE
         || abortf || parallel_parent_aborted(node)) {
       continue;
@@ -138,23 +137,18 @@ static score_t scout_search(searchNode * node, int depth,
   init_simple_mutex(&LMR_mutex);
 
   if (!cutoff) {
-    sort_incremental(move_list + critical_moves,
-                     good_moves - critical_moves,
-                     good_moves - critical_moves);
+    int num_remaining = picker_num_remaining(&picker);
     //if (depth > DEEP_DEPTH_THRESHOLD || (num_of_moves > MOVE_THRESHOLD && depth > DEPTH_THRESHOLD)) { // parallel part with coarsening
     if (depth > DEPTH_THRESHOLD) {
-      cilk_for(int mv_index = critical_moves;
-               mv_index < num_of_moves; mv_index++) {
+      cilk_for(int i = 0; i < num_remaining; i++) {
         do {
           if (node->abort)
             continue;
 
           simple_acquire(&LMR_mutex);
           // Get the next move from the move list.
-           int local_index = number_of_moves_evaluated++;
-
-          // Get the next move from the move list.
-          move_t mv = get_move(move_list[local_index]);
+          move_t mv = next_move(&picker);
+          int local_index = picker.num_tried - 1;
 
           if (TRACE_MOVES) {
             print_move_info(mv, node->ply);
@@ -162,9 +156,16 @@ static score_t scout_search(searchNode * node, int depth,
 
           __sync_fetch_and_add(node_count_serial, 1);
 
+          // a strand of its own, making moves on a copy of the position,
+          // taken under the lock since next_move() may trace its lasers
+          position_t position = *(node->position);
+          undo_stack_t stack;
+          init_undo_stack(&stack, node->stack);
+
           moveEvaluationResult result;
-          evaluateMove(node, mv, killer_a, killer_b, killer_c, killer_d,
-                          SEARCH_SCOUT, node_count_serial, &result, &LMR_mutex);
+          evaluateMove(node, &position, &stack, mv, killer_a, killer_b,
+                       killer_c, killer_d, SEARCH_SCOUT, node_count_serial,
+                       &result, &LMR_mutex);
 
           // we unlock the mutex in evaluateMove
           tbassert(LMR_mutex == 0, "LMR mutex not unlocked\n");
@@ -191,13 +192,13 @@ static score_t scout_search(searchNode * node, int depth,
         } while (false);
       }
     } else {                    // serial part
-      for (int mv_index = critical_moves; mv_index < num_of_moves; mv_index++) {
+      for (int i = 0; i < num_remaining; i++) {
         if (node->abort)
           break;
 
         // Get the next move from the move list.
-        int local_index = number_of_moves_evaluated++;
-        move_t mv = get_move(move_list[local_index]);
+        move_t mv = next_move(&picker);
+        int local_index = picker.num_tried - 1;
 
         if (TRACE_MOVES) {
           print_move_info(mv, node->ply);
@@ -206,9 +207,9 @@ static score_t scout_search(searchNode * node, int depth,
         __sync_fetch_and_add(node_count_serial, 1);
 
         moveEvaluationResult result;
-        evaluateMove(node, mv, killer_a, killer_b, killer_c, killer_d,
-                                                   SEARCH_SCOUT,
-                                                   node_count_serial, &result, NULL);
+        evaluateMove(node, node->position, node->stack, mv, killer_a,
+                     killer_b, killer_c, killer_d, SEARCH_SCOUT,
+                     node_count_serial, &result, NULL);
 
         if (result.type == MOVE_ILLEGAL || result.type == MOVE_IGNORE
             || abortf || parallel_parent_aborted(node)) {
@@ -235,14 +236,15 @@ static score_t scout_search(searchNode * node, int depth,
   }
 
   if (node->quiescence == false) {
-    update_best_move_history(&(node->position), node->best_move_index,
-                             move_list, number_of_moves_evaluated);
+    update_best_move_history(node->position, node->stack,
+                             node->best_move_index, picker.moves,
+                             picker.num_tried);
   }
 
   tbassert(abs(node->best_score) != -INF, "best_score = %d\n",
            node->best_score);
 
-  // Reads node->position.key, node->depth, node->best_score, and node->ply
+  // Reads node->position->key, node->depth, node->best_score, and node->ply
   update_transposition_table(node);
 
   return node->best_score;
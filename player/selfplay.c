@@ -0,0 +1,245 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+// Self-play games, to make corpora for the tuner.
+//
+// selfplay() plays games of the engine against itself, at a fixed depth or
+// number of nodes per move, all at once: each game is an iteration of a
+// cilk_for with positions and root moves of its own.  The games share the
+// transposition table (unless use_tt is 0) and the move ordering tables, as
+// the workers of a parallel search do.  Game g starts with line g of the
+// opening book, wrapping around, and may go on with a few random moves.
+// Games end as they do in the autotester: when a King is zapped, on the third
+// time a position occurs, after NO_ZAP_PLIES plies without a zap, or after
+// max_plies plies.
+//
+// Each position searched is written out as a tune_record_t with the score of
+// the search and the result of the game.
+
+#include "./selfplay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cilk/cilk.h>
+
+#include "./fen.h"
+#include "./move_gen.h"
+#include "./search.h"
+#include "./simple_mutex.h"
+#include "./tt.h"
+#include "./tune.h"
+#include "./util.h"
+
+#define NO_ZAP_PLIES 200         // the n-move draw rule of the autotester
+#define MAX_BOOK_MOVES 10        // moves played from an opening line
+#define MAX_BOOK_LINE 256        // characters in an opening line
+
+// An opening book, one line of moves per game
+typedef struct book {
+  int          num_lines;
+  char         (*lines)[MAX_BOOK_LINE];
+} book_t;
+
+// The shared output of the games
+typedef struct selfplay_out {
+  FILE         *file;
+  simple_mutex_t mutex;
+  uint64_t     positions;
+  int          wins[2];
+  int          draws;
+} selfplay_out_t;
+
+// Reads the lines of file into book.  Returns 1 if it cannot be read.
+static int read_book(char *file, book_t *book) {
+  FILE *f = fopen(file, "r");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open %s\n", file);
+    return 1;
+  }
+  char line[MAX_BOOK_LINE];
+  int size = 0;
+  book->num_lines = 0;
+  book->lines = NULL;
+  while (fgets(line, MAX_BOOK_LINE, f) != NULL) {
+    if (book->num_lines == size) {
+      size = 2 * size + 64;
+      book->lines = realloc(book->lines, size * sizeof(*book->lines));
+    }
+    snprintf(book->lines[book->num_lines++], MAX_BOOK_LINE, "%s", line);
+  }
+  fclose(f);
+  return 0;
+}
+
+// 1 if the last move zapped the Black King, -1 if it zapped the White King,
+// and 0 otherwise.
+static int king_zapped(position_t *p) {
+  for (int i = 0; i < p->victims.zapped_count; i++) {
+    piece_t x = p->victims.zapped[i];
+    if (ptype_of(x) == KING) {
+      return (color_of(x) == WHITE) ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+// Whether game[ply] occurred twice before, since the last zap at last_zap
+static bool third_occurrence(position_t *game, int ply, int last_zap) {
+  int count = 0;
+  for (int i = ply - 4; i >= last_zap; i -= 2) {
+    if (game[i].key == game[ply].key && ++count == 2) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Makes mv in game[ply], and tells whether the game goes on.  If it ends,
+// sets *result to its result for White.
+static bool play_move(position_t *game, int *ply, int *last_zap, move_t mv,
+                      int max_plies, int *result) {
+  victims_t x = make_move(&game[*ply], &game[*ply + 1], mv);
+  if (is_ILLEGAL(x) || is_KO(x)) {
+    *result = 0;
+    return false;
+  }
+  (*ply)++;
+  if (game[*ply].victims.zapped_count > 0) {
+    *last_zap = *ply;
+  }
+
+  *result = king_zapped(&game[*ply]);
+  return *result == 0 && !third_occurrence(game, *ply, *last_zap) &&
+         *ply - *last_zap < NO_ZAP_PLIES && *ply < max_plies;
+}
+
+// Plays game g and writes its positions to out.
+static void play_game(selfplay_args_t *args, book_t *book, int g,
+                      selfplay_out_t *out) {
+  position_t *game =
+      (position_t *) malloc((args->max_plies + 1) * sizeof(position_t));
+  // zeroed, so that the padding written out with the records is too
+  tune_record_t *rec =
+      (tune_record_t *) calloc(args->max_plies, sizeof(tune_record_t));
+  root_moves_t *root = (root_moves_t *) malloc(sizeof(root_moves_t));
+  int num_rec = 0;
+  int ply = 0;
+  int last_zap = 0;
+  int result = 0;
+  bool going = true;
+
+  fen_to_pos(&game[0], "");
+
+  if (book->num_lines > 0) {
+    char line[MAX_BOOK_LINE];
+    char *save;
+    snprintf(line, MAX_BOOK_LINE, "%s", book->lines[g % book->num_lines]);
+    char *tok = strtok_r(line, " \t\r\n", &save);
+    for (int i = 0; going && tok != NULL && i < MAX_BOOK_MOVES; i++) {
+      move_t mv = move_from_str(&game[ply], tok);
+      if (mv == 0) {
+        break;  // the rest of the line is not playable
+      }
+      going = play_move(game, &ply, &last_zap, mv, args->max_plies, &result);
+      tok = strtok_r(NULL, " \t\r\n", &save);
+    }
+  }
+
+  unsigned int seed = g + 1;
+  for (int i = 0; going && i < args->random_plies; i++) {
+    sortable_move_t lst[MAX_NUM_MOVES];
+    int num_moves = generate_all(&game[ply], lst, true);
+    int r = rand_r(&seed) % num_moves;
+    move_t mv = 0;
+    for (int j = 0; j < num_moves && mv == 0; j++) {  // skip Ko moves
+      mv = get_move(lst[(r + j) % num_moves]);
+      if (is_KO(make_move(&game[ply], &game[ply + 1], mv))) {
+        mv = 0;
+      }
+    }
+    going = (mv != 0) &&
+            play_move(game, &ply, &last_zap, mv, args->max_plies, &result);
+  }
+
+  while (going) {
+    move_t mv = 0;
+    score_t score = 0;
+    uint64_t nodes = 0;
+    for (int d = 1; d <= args->depth; d++) {
+      score = searchRoot(&game[ply], -INF, INF, d, 0, &mv, &nodes, root,
+                         NULL);
+      if (args->nodes > 0 && nodes >= args->nodes) {
+        break;
+      }
+    }
+
+    if (mv == 0) {
+      break;  // no legal move; a draw
+    }
+
+    pos_to_packed(&game[ply], &rec[num_rec].pos);
+    rec[num_rec].score = (color_to_move_of(&game[ply]) == WHITE) ? score
+                                                                 : -score;
+    num_rec++;
+    going = play_move(game, &ply, &last_zap, mv, args->max_plies, &result);
+  }
+
+  for (int i = 0; i < num_rec; i++) {
+    rec[i].result = result;
+  }
+
+  simple_acquire(&out->mutex);
+  fwrite(rec, sizeof(tune_record_t), num_rec, out->file);
+  out->positions += num_rec;
+  if (result == 0) {
+    out->draws++;
+  } else {
+    out->wins[(result > 0) ? WHITE : BLACK]++;
+  }
+  simple_release(&out->mutex);
+
+  free(root);
+  free(rec);
+  free(game);
+}
+
+// Plays the games that args describes and writes their positions to file,
+// as a corpus for tune_eval_weights().  Returns 1 if a file cannot be opened.
+int selfplay(char *file, selfplay_args_t *args) {
+  book_t book = { 0, NULL };
+  if (args->book != NULL && read_book(args->book, &book) != 0) {
+    return 1;
+  }
+
+  selfplay_out_t out = { NULL, 0, 0, { 0, 0 }, 0 };
+  out.file = fopen(file, "wb");
+  if (out.file == NULL) {
+    fprintf(stderr, "Cannot open %s\n", file);
+    free(book.lines);
+    return 1;
+  }
+  init_simple_mutex(&out.mutex);
+  tune_header_t header = { TUNE_MAGIC, BOARD_WIDTH };
+  fwrite(&header, sizeof(header), 1, out.file);
+
+  // one search for all the games, without a time limit
+  init_abort_timer(99999999999.0);
+  reset_abort();
+  init_tics();
+  init_best_move_history();
+  tt_age_hashtable();
+
+  double start = milliseconds();
+  cilk_for (int g = 0; g < args->games; g++) {
+    play_game(args, &book, g, &out);
+  }
+  double time = milliseconds() - start;
+
+  fclose(out.file);
+  free(book.lines);
+  printf("info string %d games (+%d =%d -%d), %" PRIu64 " positions in "
+         "%.0f ms\n", args->games, out.wins[WHITE], out.draws, out.wins[BLACK],
+         out.positions, time);
+  return 0;
+}
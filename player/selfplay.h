@@ -0,0 +1,21 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+#ifndef SELFPLAY_H
+#define SELFPLAY_H
+
+#include <stdint.h>
+
+// How selfplay() plays its games
+typedef struct selfplay_args {
+  int          games;            // number of games
+  int          depth;            // search depth of each move
+  uint64_t     nodes;            // if not 0, stop deepening at this many nodes
+  char         *book;            // opening lines, or NULL to start them all
+                                 // from the starting position
+  int          random_plies;     // random moves after the opening line
+  int          max_plies;        // game length at which a game is drawn
+} selfplay_args_t;
+
+int selfplay(char *file, selfplay_args_t *args);
+
+#endif  // SELFPLAY_H
@@ -17,7 +17,7 @@ extern inline void simple_acquire(simple_mutex_t* mutex) {
 //  }
 }
 
-inline void simple_release(simple_mutex_t* mutex) {
+extern inline void simple_release(simple_mutex_t* mutex) {
   if (!__sync_bool_compare_and_swap(mutex, 1, 0)) {
     printf("ERROR!\n");
   }
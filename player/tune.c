@@ -0,0 +1,314 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+// Offline tuning of the weights of eval() on a corpus of positions, each
+// labeled with the result of the game it was played in.
+//
+// The score of a position is linear in the weights (see eval_features()), so
+// the features of every position are computed once, when the corpus is
+// loaded.  The predicted result of a position is sigmoid(k * score).  k is
+// fitted to the weights as they are, and then the weights are fitted by
+// minimizing the logistic loss of the predictions with Adam.  Each pass over
+// the corpus sums the loss and its gradient over blocks of positions in
+// parallel.  The features are kept in one array per weight, so that the
+// scores of consecutive positions can be computed with vector instructions.
+
+#include "./tune.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cilk/cilk.h>
+
+#include "./tbassert.h"
+#include "./util.h"
+
+#define TUNE_BLOCK 4096          // positions per parallel task
+
+// eval.c
+extern int RANDOMIZE;
+
+// The corpus, one array per feature
+typedef struct tune_set {
+  int          n;                // number of positions
+  float        *x[NUM_EVAL_FEATURES];
+  float        *base;            // the terms of eval() that are not tuned
+  float        *y;               // result for White: 1, 0.5 or 0
+  int          num_blocks;
+  double       *block_loss;      // loss of each block in the last pass
+  double       (*block_grad)[NUM_EVAL_FEATURES];
+} tune_set_t;
+
+static void free_tune_set(tune_set_t *ts) {
+  for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+    free(ts->x[j]);
+  }
+  free(ts->base);
+  free(ts->y);
+  free(ts->block_loss);
+  free(ts->block_grad);
+}
+
+// Debugging function: checks that the model of eval() with the current
+// weights agrees with eval() on position i of ts, which is p, up to the
+// rounding of eval() that eval_features() describes.
+static inline bool model_matches_eval(tune_set_t *ts, int i,
+                                      position_t *p) {
+  if (RANDOMIZE) {
+    return true;
+  }
+  double model = ts->base[i];
+  for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+    model += *eval_feature_weight[j] * ts->x[j][i];
+  }
+  position_t q = *p;
+  score_t score = eval(&q, false);
+  if (color_to_move_of(p) == BLACK) {
+    score = -score;
+  }
+  int rounded = pawns_count_of(p, WHITE) + pawns_count_of(p, BLACK) + 2;
+  return fabs(model / EV_SCORE_RATIO - score) <=
+         1 + (rounded + 1.0) / EV_SCORE_RATIO;
+}
+
+// Reads the corpus in file and computes the features of its positions.
+// Records whose Kings are not right are left out.  Returns 1 if the file
+// cannot be read or was not written for this board.
+static int load_tune_set(char *file, tune_set_t *ts) {
+  FILE *f = fopen(file, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open %s\n", file);
+    return 1;
+  }
+
+  tune_header_t header;
+  if (fread(&header, sizeof(header), 1, f) != 1 ||
+      header.magic != TUNE_MAGIC || header.board_width != BOARD_WIDTH) {
+    fprintf(stderr, "%s is not a tuning corpus for this board\n", file);
+    fclose(f);
+    return 1;
+  }
+  fseek(f, 0, SEEK_END);
+  int n = (ftell(f) - sizeof(header)) / sizeof(tune_record_t);
+  fseek(f, sizeof(header), SEEK_SET);
+
+  tune_record_t *rec = (tune_record_t *) malloc(n * sizeof(tune_record_t));
+  if (rec == NULL || fread(rec, sizeof(tune_record_t), n, f) != n) {
+    fprintf(stderr, "Cannot read %d positions from %s\n", n, file);
+    free(rec);
+    fclose(f);
+    return 1;
+  }
+  fclose(f);
+
+  for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+    ts->x[j] = (float *) malloc(n * sizeof(float));
+  }
+  ts->base = (float *) malloc(n * sizeof(float));
+  ts->y = (float *) malloc(n * sizeof(float));
+  bool *ok = (bool *) malloc(n * sizeof(bool));
+
+  cilk_for (int i = 0; i < n; i++) {
+    position_t p;
+    double x[NUM_EVAL_FEATURES];
+    ok[i] = (packed_to_pos(&p, &rec[i].pos) == 0);
+    if (ok[i]) {
+      ts->base[i] = eval_features(&p, x);
+      for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+        ts->x[j][i] = x[j];
+      }
+      ts->y[i] = (rec[i].result + 1) / 2.0;
+      tbassert(model_matches_eval(ts, i, &p), "position %d\n", i);
+    }
+  }
+
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    if (ok[i]) {
+      for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+        ts->x[j][m] = ts->x[j][i];
+      }
+      ts->base[m] = ts->base[i];
+      ts->y[m] = ts->y[i];
+      m++;
+    }
+  }
+  if (m < n) {
+    fprintf(stderr, "Left out %d positions without one King of each color\n",
+            n - m);
+  }
+  free(ok);
+  free(rec);
+
+  ts->n = m;
+  ts->num_blocks = (m + TUNE_BLOCK - 1) / TUNE_BLOCK;
+  ts->block_loss = (double *) calloc(ts->num_blocks, sizeof(double));
+  ts->block_grad = calloc(ts->num_blocks, sizeof(*ts->block_grad));
+  return 0;
+}
+
+// Adds the gradient of the loss over positions [begin, end) of ts, with
+// respect to the weights w, to grad, and returns the loss.
+static double tune_block(tune_set_t *ts, int begin, int end, const float w[],
+                         float k, double grad[NUM_EVAL_FEATURES]) {
+  float d[TUNE_BLOCK];
+  const float *base = ts->base + begin;
+  const float *y = ts->y + begin;
+  int n = end - begin;
+
+  for (int i = 0; i < n; i++) {
+    float score = base[i];
+    for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+      score += w[j] * ts->x[j][begin + i];
+    }
+    d[i] = score;
+  }
+
+  // d[i] becomes the derivative of the loss with respect to score i
+  double loss = 0;
+  for (int i = 0; i < n; i++) {
+    float prob = 1 / (1 + expf(-k * d[i]));
+    loss -= y[i] * logf(prob + 1e-7f) + (1 - y[i]) * logf(1 - prob + 1e-7f);
+    d[i] = (prob - y[i]) * k;
+  }
+
+  for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+    const float *x = ts->x[j] + begin;
+    float g = 0;
+    for (int i = 0; i < n; i++) {
+      g += d[i] * x[i];
+    }
+    grad[j] += g;
+  }
+  return loss;
+}
+
+// Mean loss over ts of the weights w, with its gradient in grad.  The blocks
+// are summed in order, so the result does not depend on the scheduling.
+static double tune_pass(tune_set_t *ts, const double w[], double k,
+                        double grad[NUM_EVAL_FEATURES]) {
+  float wf[NUM_EVAL_FEATURES];
+  for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+    wf[j] = w[j];
+  }
+
+  cilk_for (int b = 0; b < ts->num_blocks; b++) {
+    int end = (b + 1) * TUNE_BLOCK;
+    for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+      ts->block_grad[b][j] = 0;
+    }
+    ts->block_loss[b] = tune_block(ts, b * TUNE_BLOCK,
+                                   (end < ts->n) ? end : ts->n, wf, k,
+                                   ts->block_grad[b]);
+  }
+
+  double loss = 0;
+  for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+    grad[j] = 0;
+  }
+  for (int b = 0; b < ts->num_blocks; b++) {
+    loss += ts->block_loss[b];
+    for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+      grad[j] += ts->block_grad[b][j];
+    }
+  }
+  for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+    grad[j] /= ts->n;
+  }
+  return loss / ts->n;
+}
+
+// The k, per ev_score_t unit, for which the weights w predict the results of
+// ts best, by golden section search on log k.
+static double fit_scale(tune_set_t *ts, const double w[]) {
+  double grad[NUM_EVAL_FEATURES];
+  const double phi = (sqrt(5) - 1) / 2;
+  double lo = log(1e-7);
+  double hi = log(1e-2);
+  double a = hi - phi * (hi - lo);
+  double b = lo + phi * (hi - lo);
+  double loss_a = tune_pass(ts, w, exp(a), grad);
+  double loss_b = tune_pass(ts, w, exp(b), grad);
+
+  for (int it = 0; it < 40; it++) {
+    if (loss_a < loss_b) {
+      hi = b;
+      b = a;
+      loss_b = loss_a;
+      a = hi - phi * (hi - lo);
+      loss_a = tune_pass(ts, w, exp(a), grad);
+    } else {
+      lo = a;
+      a = b;
+      loss_a = loss_b;
+      b = lo + phi * (hi - lo);
+      loss_b = tune_pass(ts, w, exp(b), grad);
+    }
+  }
+  return exp((lo + hi) / 2);
+}
+
+// Fits the weights of eval() to the corpus in file, starting from w and
+// keeping weight j within [lo[j], hi[j]], and leaves them in w.  rate is the
+// largest step of the weights per iteration, in ev_score_t units.  Returns 1
+// if the corpus cannot be loaded.
+int tune_eval_weights(char *file, int iterations, double rate,
+                      const int lo[NUM_EVAL_FEATURES],
+                      const int hi[NUM_EVAL_FEATURES],
+                      double w[NUM_EVAL_FEATURES]) {
+  tune_set_t ts = { 0 };
+  double start = milliseconds();
+  if (load_tune_set(file, &ts) != 0) {
+    free_tune_set(&ts);
+    return 1;
+  }
+  if (ts.n == 0) {
+    fprintf(stderr, "No positions in %s\n", file);
+    free_tune_set(&ts);
+    return 1;
+  }
+  printf("info string loaded %d positions in %.0f ms\n", ts.n,
+         milliseconds() - start);
+
+  double grad[NUM_EVAL_FEATURES];
+  double k = fit_scale(&ts, w);
+  printf("info string scale %.1f per result, loss %.6f\n",
+         1 / (k * EV_SCORE_RATIO), tune_pass(&ts, w, k, grad));
+
+  // Adam, with the usual decay rates
+  const double beta1 = 0.9;
+  const double beta2 = 0.999;
+  double m[NUM_EVAL_FEATURES] = { 0 };
+  double v[NUM_EVAL_FEATURES] = { 0 };
+  double pow1 = 1;
+  double pow2 = 1;
+
+  start = milliseconds();
+  for (int it = 1; it <= iterations; it++) {
+    double loss = tune_pass(&ts, w, k, grad);
+    pow1 *= beta1;
+    pow2 *= beta2;
+    for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+      m[j] = beta1 * m[j] + (1 - beta1) * grad[j];
+      v[j] = beta2 * v[j] + (1 - beta2) * grad[j] * grad[j];
+      double step = (m[j] / (1 - pow1)) / (sqrt(v[j] / (1 - pow2)) + 1e-12);
+      w[j] -= rate * step;
+      w[j] = (w[j] < lo[j]) ? lo[j] : (w[j] > hi[j]) ? hi[j] : w[j];
+    }
+    if (it % 100 == 0) {
+      printf("info string iteration %d loss %.6f\n", it, loss);
+    }
+  }
+  double time = milliseconds() - start;
+
+  for (int j = 0; j < NUM_EVAL_FEATURES; j++) {
+    w[j] = round(w[j]);
+  }
+  printf("info string loss %.6f after %d iterations in %.0f ms, "
+         "%.1f M positions/s\n", tune_pass(&ts, w, k, grad), iterations, time,
+         (double) ts.n * iterations / (time * 1000 + 1e-9));
+
+  free_tune_set(&ts);
+  return 0;
+}
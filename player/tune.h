@@ -0,0 +1,31 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdint.h>
+
+#include "./eval.h"
+#include "./fen.h"
+
+// A tuning corpus is a tune_header_t followed by any number of tune_record_t,
+// in the byte order and layout of the machine that wrote it.
+#define TUNE_MAGIC 0x4e55544c   // "LTUN"
+
+typedef struct tune_header {
+  uint32_t     magic;            // TUNE_MAGIC
+  uint32_t     board_width;      // BOARD_WIDTH of the engine that wrote it
+} tune_header_t;
+
+typedef struct tune_record {
+  packed_pos_t pos;
+  int16_t      score;            // search score, from White's point of view
+  int8_t       result;           // 1 White won, -1 Black won, 0 draw
+} tune_record_t;
+
+int tune_eval_weights(char *file, int iterations, double rate,
+                      const int lo[NUM_EVAL_FEATURES],
+                      const int hi[NUM_EVAL_FEATURES],
+                      double w[NUM_EVAL_FEATURES]);
+
+#endif  // TUNE_H